@@ -15,11 +15,52 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 
 namespace gtl
 {
 
+    /** \class GazeRuntime
+    *   Threads that can be shared by any number of GazeApi instances.
+    *
+    *   A GazeApi of its own runs two threads per connection. Instances constructed with a GazeRuntime instead
+    *   multiplex their connections on the runtime's I/O threads and call their listeners from its dispatch
+    *   threads. Listeners of one GazeApi are still called by one thread at a time and in order, but listeners
+    *   of different instances may be called concurrently when there is more than one dispatch thread.
+    *
+    *   The GazeRuntime must outlive every GazeApi constructed with it. Such a GazeApi must not be destroyed
+    *   from one of its own listeners, as its destructor waits for the listener call to return.
+    */
+    class GazeRuntime
+    {
+    public:
+        /** GazeRuntime constructor.
+         *
+         * \param[in] io_threads number of threads reading from and writing to the sockets.
+         * \param[in] dispatch_threads number of threads calling listeners.
+         * \param[in] io_options scheduling of the I/O threads, applied on a best effort basis.
+         * \param[in] dispatch_options scheduling of the dispatch threads, applied on a best effort basis.
+         */
+        explicit GazeRuntime( unsigned int io_threads = 1, unsigned int dispatch_threads = 1,
+            GazeApiThreadOptions const & io_options = GazeApiThreadOptions(),
+            GazeApiThreadOptions const & dispatch_options = GazeApiThreadOptions() );
+        ~GazeRuntime();
+
+    private:
+        GazeRuntime( GazeRuntime const & other );
+        GazeRuntime & operator = ( GazeRuntime const & other );
+
+        friend class GazeApi;
+        class Impl;
+
+#if __cplusplus <= 199711L
+        std::auto_ptr<Impl> m_impl;
+#else
+        std::unique_ptr<Impl> m_impl;
+#endif
+    };
+
     /** \class GazeApi
     *   This is the main entry point into the GaziApi library for communicating and controlling The Eyetribe Tracker server
     */
@@ -35,8 +76,22 @@ namespace gtl
          * 0 = disabled,
          * 1 = send (sync/async),
          * 2 = all send/recv
+         *
+         * \param[in] threading With GATM_THREADED (default) messages are received and listeners are called
+         * on internal threads. With GATM_POLLED the GazeApi starts no threads at all: messages are only
+         * received and dispatched within poll(), run_for() and blocking calls, on the calling thread. A
+         * polled GazeApi must only be used from one thread at a time.
          */
-        explicit GazeApi( int verbose_level = 0 );
+        explicit GazeApi( int verbose_level = 0, GazeApiThreadingMode threading = GATM_THREADED );
+
+        /** GazeApi constructor.
+         * Creates an instance of the GazeApi that starts no threads of its own but runs on those of 'runtime'.
+         *
+         * \param[in] runtime GazeRuntime shared with other instances. It must outlive this GazeApi, which
+         * must not be destroyed from one of its own listeners.
+         * \param[in] verbose_level as above.
+         */
+        explicit GazeApi( GazeRuntime & runtime, int verbose_level = 0 );
         ~GazeApi();
 
         /** Add an IGazeListener to the GazeApi.
@@ -46,13 +101,71 @@ namespace gtl
          */
         void add_listener( IGazeListener & listener );
 
+        /** Add an IGazeListener that is called on a thread chosen by 'execution', so that a slow listener,
+         * e.g. one writing to disk, does not delay the others.
+         *
+         * With GALE_WORKER and GALE_POOL, notifications are queued for the listener, which is then called in
+         * order and one call at a time by its own thread or by a pool thread respectively. Pool threads are those
+         * of the GazeRuntime if the GazeApi runs on one, where they also dispatch messages, so such a runtime needs
+         * more than one dispatch thread for a slow listener to not delay the others. Frames are queued as GazeData,
+         * not as received messages.
+         * Should the listener fall queue_capacity calls behind, its oldest pending call is dropped. Once
+         * remove_listener() returns, the listener is not called anymore. Any earlier registration of the
+         * listener is replaced.
+         *
+         * \param[in] listener The IGazeListener listener to be added.
+         * \param[in] execution how the listener is called.
+         * \param[in] queue_capacity largest number of pending calls for GALE_WORKER and GALE_POOL.
+         * \sa remove_listener(IGazeListener & listener).
+         */
+        void add_listener( IGazeListener & listener, GazeApiListenerExecution execution, std::size_t queue_capacity = 1024 );
+
         /** Remove an IGazeListener from the GazeApi.
+         *
+         * Once this returns, the listener is not called anymore and may be deleted: the call waits for
+         * notifications in progress on other threads. Called from within a listener, it returns right away
+         * instead, as that notification would wait for itself, so a notification in progress on another
+         * thread may still reach the listener. Do not call it while holding a lock the listener takes.
          *
          * \param[in] listener The IGazeListener listener to be removed.
          * \sa add_listener(IGazeListener & listener).
          */
         void remove_listener( IGazeListener & listener );
 
+        /** Add an IGazeBatchListener to the GazeApi.
+         *
+         * \param[in] listener The IGazeBatchListener listener to be added.
+         * \sa remove_listener(IGazeBatchListener & listener).
+         */
+        void add_listener( IGazeBatchListener & listener );
+
+        /** Remove an IGazeBatchListener from the GazeApi.
+         *
+         * Once this returns, the listener is not called anymore, see remove_listener(IGazeListener & listener).
+         *
+         * \param[in] listener The IGazeBatchListener listener to be removed.
+         * \sa add_listener(IGazeBatchListener & listener).
+         */
+        void remove_listener( IGazeBatchListener & listener );
+
+        /** Add an IGazeEventListener to the GazeApi.
+         *
+         * Fixations and saccades are only detected while at least one IGazeEventListener is added.
+         *
+         * \param[in] listener The IGazeEventListener listener to be added.
+         * \sa set_event_options(GazeApiEventOptions const & options).
+         */
+        void add_listener( IGazeEventListener & listener );
+
+        /** Remove an IGazeEventListener from the GazeApi.
+         *
+         * Once this returns, the listener is not called anymore, see remove_listener(IGazeListener & listener).
+         *
+         * \param[in] listener The IGazeEventListener listener to be removed.
+         * \sa add_listener(IGazeEventListener & listener).
+         */
+        void remove_listener( IGazeEventListener & listener );
+
         /** Add an ICalibrationResultListener to the GazeApi.
          *
          * \param[in] listener The ICalibrationResultListener listener to be added.
@@ -60,7 +173,18 @@ namespace gtl
          */
         void add_listener( ICalibrationResultListener & listener );
 
+        /** Add an ICalibrationResultListener that is called on a thread chosen by 'execution'.
+         *
+         * \param[in] listener The ICalibrationResultListener listener to be added.
+         * \param[in] execution how the listener is called.
+         * \param[in] queue_capacity largest number of pending calls for GALE_WORKER and GALE_POOL.
+         * \sa add_listener(IGazeListener & listener, GazeApiListenerExecution execution, std::size_t queue_capacity).
+         */
+        void add_listener( ICalibrationResultListener & listener, GazeApiListenerExecution execution, std::size_t queue_capacity = 1024 );
+
         /** Remove an ICalibrationResultListener from the GazeApi.
+         *
+         * Once this returns, the listener is not called anymore, see remove_listener(IGazeListener & listener).
          *
          * \param[in] listener The ICalibrationResultListener listener to be removed.
          * \sa add_listener(ICalibrationResultListener & listener).
@@ -76,6 +200,8 @@ namespace gtl
 
         /** Remove an IConnectionStateListener from the GazeApi.
         *
+        * Once this returns, the listener is not called anymore, see remove_listener(IGazeListener & listener).
+        *
         * \param[in] listener The IConnectionStateListener listener to be removed.
         * \sa add_listener(IConnectionStateListener & listener).
         */
@@ -88,7 +214,18 @@ namespace gtl
          */
         void add_listener( ITrackerStateListener & listener );
 
+        /** Add an ITrackerStateListener that is called on a thread chosen by 'execution'.
+         *
+         * \param[in] listener The ITrackerStateListener listener to be added.
+         * \param[in] execution how the listener is called.
+         * \param[in] queue_capacity largest number of pending calls for GALE_WORKER and GALE_POOL.
+         * \sa add_listener(IGazeListener & listener, GazeApiListenerExecution execution, std::size_t queue_capacity).
+         */
+        void add_listener( ITrackerStateListener & listener, GazeApiListenerExecution execution, std::size_t queue_capacity = 1024 );
+
         /** Remove an ITrackerStateListener from the GazeApi.
+         *
+         * Once this returns, the listener is not called anymore, see remove_listener(IGazeListener & listener).
          *
          * \param[in] listener The ITrackerStateListener listener to be removed.
          * \sa add_listener(ITrackerStateListener & listener).
@@ -103,6 +240,8 @@ namespace gtl
         void add_listener( ICalibrationProcessHandler & listener );
 
         /** Remove an ICalibrationProcessHandler from the GazeApi.
+         *
+         * Once this returns, the listener is not called anymore, see remove_listener(IGazeListener & listener).
          *
          * \param[in] listener The ICalibrationProcessHandler listener to be removed.
          * \sa add_listener(ICalibrationProcessHandler & listener).
@@ -132,6 +271,90 @@ namespace gtl
         /** Disconnect from server. */
         void disconnect();
 
+        /** Choose how gaze frames are delivered when listeners are slower than the tracker.
+         *
+         * With GAFD_ALL (default) every frame is queued and delivered. With GAFD_LATEST a frame that is
+         * superseded by a newer one before it could be dispatched is dropped, so listeners always receive
+         * the freshest data and the queue cannot grow. Replies and notifications are always delivered in order.
+         *
+         * \param[in] delivery the GazeApiFrameDelivery policy to use.
+         */
+        void set_frame_delivery( GazeApiFrameDelivery delivery );
+
+        /** Smooth the raw gaze coordinates of incoming frames with a One Euro or Kalman filter.
+         *
+         * raw, lefteye.raw and righteye.raw are filtered as frames arrive, before they are delivered to listeners,
+         * stored for get_frame() and the frame history, or used to detect fixations; avg is left as the server sent it.
+         * The defaults aim at less lag than avg at comparable jitter; the One Euro filter in particular follows
+         * saccades almost immediately. Setting a filter restarts filtering.
+         *
+         * \param[in] options the GazeApiFilterOptions to use; GAF_NONE (default) turns filtering off.
+         */
+        void set_filter( GazeApiFilterOptions const & options );
+
+        /** Choose the algorithm and thresholds used to detect fixations and saccades for IGazeEventListener.
+         *
+         * Changing the options discards a fixation or saccade in progress without reporting it.
+         *
+         * \param[in] options the GazeApiEventOptions to use.
+         */
+        void set_event_options( GazeApiEventOptions const & options );
+
+        /** Set the scheduling of one of the threads this GazeApi runs on, e.g. to pin the dispatch thread to
+         * a core and give it real-time priority for gaze-contingent displays.
+         *
+         * Each thread applies its options itself: a running thread right away, the I/O thread otherwise when
+         * it is started by connect(). Options that cannot be applied, e.g. SCHED_FIFO without the privilege
+         * for it, are skipped and reported on std::cout if verbose output is enabled.
+         *
+         * \param[in] role which of the two threads to set.
+         * \param[in] options scheduling to apply.
+         * \returns false if the GazeApi has no threads of its own, i.e. when polled or running on a
+         * GazeRuntime, whose threads are set when it is constructed.
+         */
+        bool set_thread_options( GazeApiThreadRole role, GazeApiThreadOptions const & options );
+
+        /** Receive and dispatch all available messages without blocking (GATM_POLLED only).
+         *
+         * Listeners are called from within this function. Meant to be called from the application's own loop,
+         * e.g. once per rendered frame.
+         *
+         * \returns number of messages dispatched.
+         * \sa run_for(unsigned int timeout_ms).
+         */
+        std::size_t poll();
+
+        /** Wait up to timeout_ms for messages, then dispatch all available ones (GATM_POLLED only).
+         *
+         * Returns as soon as messages have been handled, or once the timeout has passed.
+         *
+         * \param[in] timeout_ms longest time to wait, in milliseconds.
+         * \returns number of messages dispatched.
+         * \sa poll().
+         */
+        std::size_t run_for( unsigned int timeout_ms );
+
+        /** Get the socket of the connection to the server, to wait for it in an external event loop (GATM_POLLED only).
+         *
+         * Register the handle for readability with e.g. epoll, libuv or a QSocketNotifier and call process_readable()
+         * whenever it is reported readable. Only use it for waiting; never read from or write to it directly.
+         * Requests queued behind one still being written, and request timeouts, are only handled while polling,
+         * so poll() should also be called after issuing requests and from time to time.
+         *
+         * \returns the native handle; it changes with every connect().
+         * \sa process_readable().
+         */
+        GazeApiNativeHandle native_handle() const;
+
+        /** Read and dispatch everything available on the socket without blocking (GATM_POLLED only).
+         *
+         * Equivalent to poll(); named for use from an external event loop's readability callback.
+         *
+         * \returns number of messages dispatched.
+         * \sa native_handle().
+         */
+        std::size_t process_readable();
+
         /** Set screen parameters.
          *
          * \param[in] screen the Screen parameters to be set.
@@ -152,6 +375,25 @@ namespace gtl
          */
         void get_frame( GazeData & gaze_data ) const;
 
+        /** Get the most recent GazeData frames.
+         *
+         * The GazeApi keeps the last 512 frames received (about 8.5 seconds at 60 Hz).
+         *
+         * \param[in] count maximum number of frames to retrieve.
+         * \param[out] frames the latest frames, oldest first.
+         * \returns number of frames retrieved.
+         */
+        std::size_t get_last_frames( std::size_t count, std::vector<GazeData> & frames ) const;
+
+        /** Get all recent GazeData frames from a point in time on.
+         *
+         * \param[in] time timestamp (as in GazeData::time) of the oldest frame to retrieve.
+         * \param[out] frames the frames at or after time, oldest first.
+         * \returns number of frames retrieved.
+         * \sa get_last_frames(std::size_t count, std::vector<GazeData> & frames).
+         */
+        std::size_t get_frames_since( int time, std::vector<GazeData> & frames ) const;
+
         /** Get current valid calibration
          *
          * \param[out] calib_result latest valid calibration result.
@@ -204,6 +446,47 @@ namespace gtl
          */
         void calibration_point_end();
 
+        /** Set screen parameters without blocking.
+         *
+         * \param[in] screen the Screen parameters to be set.
+         * \param[in] handler optional IRequestHandler notified when the request completes.
+         * \param[in] timeout_ms time to wait for the reply before the request completes with GARR_TIMEOUT.
+         * \returns id of the request as passed to the handler, or -1 if not connected.
+         * \sa set_screen(Screen const & screen).
+         */
+        int set_screen_async( Screen const & screen, IRequestHandler * handler = 0, unsigned int timeout_ms = 5000 );
+
+        /** Update the cached server state without blocking.
+         *  Once the handler reports GARR_OK, get_server_state() returns the updated state.
+         *
+         * \param[in] handler optional IRequestHandler notified when the request completes.
+         * \param[in] timeout_ms time to wait for the reply before the request completes with GARR_TIMEOUT.
+         * \returns id of the request as passed to the handler, or -1 if not connected.
+         * \sa update_server_state().
+         */
+        int update_server_state_async( IRequestHandler * handler = 0, unsigned int timeout_ms = 5000 );
+
+        /** Begin new calibration session without blocking.
+         *
+         * \param[in] point_count The number of points to use for calibration.
+         * \param[in] handler optional IRequestHandler notified when the request completes.
+         * \param[in] timeout_ms time to wait for the reply before the request completes with GARR_TIMEOUT.
+         * \returns id of the request as passed to the handler, or -1 if not connected.
+         * \sa calibration_start(int const point_count).
+         */
+        int calibration_start_async( int const point_count, IRequestHandler * handler = 0, unsigned int timeout_ms = 5000 );
+
+        /** Begin calibration of a new calibration point without blocking.
+         *
+         * \param[in] x x-coordinate of calibration point.
+         * \param[in] y y-coordinate of calibration point.
+         * \param[in] handler optional IRequestHandler notified when the request completes.
+         * \param[in] timeout_ms time to wait for the reply before the request completes with GARR_TIMEOUT.
+         * \returns id of the request as passed to the handler, or -1 if not connected.
+         * \sa calibration_point_start(int const x, int const y).
+         */
+        int calibration_point_start_async( int const x, int const y, IRequestHandler * handler = 0, unsigned int timeout_ms = 5000 );
+
     private:
         GazeApi( GazeApi const & other );
         GazeApi & operator = ( GazeApi const & other );
@@ -12,6 +12,8 @@
 
 #include <gazeapi_types.h>
 
+#include <cstddef>
+
 
 namespace gtl
 {
@@ -33,6 +35,55 @@ namespace gtl
         virtual void on_gaze_data( gtl::GazeData const & gaze_data ) = 0;
     };
 
+    /** \class IGazeBatchListener
+     *  Callback interface for consumers that process the live GazeData stream in batches.
+     *  Rather than one call per frame, all frames that arrived since the previous call are delivered at once,
+     *  so per-frame work such as file writes or socket sends can be amortized. Only frames pushed by the server
+     *  are delivered, in the order they arrived; a frame that comes with the reply to a request is left out.
+     */
+    class IGazeBatchListener
+    {
+    public:
+        virtual ~IGazeBatchListener() {}
+
+        /** A notification call back indicating that new GazeData frames are available.
+         * Register for updates through GazeApi::add_listener(IGazeBatchListener & listener)
+         *
+         * \param[in] frames contiguous array of frames, oldest first. Only valid during the call.
+         * \param[in] count number of frames in the array.
+         */
+        virtual void on_gaze_data_batch( gtl::GazeData const * frames, std::size_t count ) = 0;
+    };
+
+    /** \class IGazeEventListener
+     *  Callback interface for fixations and saccades, detected by the GazeApi from the live GazeData stream.
+     *  Events are detected from the raw gaze coordinates, with visual angles computed from the physical size of
+     *  the current Screen. See GazeApi::set_event_options() for the choice of algorithm and its thresholds.
+     */
+    class IGazeEventListener
+    {
+    public:
+        virtual ~IGazeEventListener() {}
+
+        /** Called once a fixation has lasted the minimum fixation duration.
+         *
+         * \param[in] fixation the fixation so far.
+         */
+        virtual void on_fixation_start( gtl::Fixation const & fixation ) = 0;
+
+        /** Called when a fixation has ended, because the gaze moved on or tracking was lost.
+         *
+         * \param[in] fixation the complete fixation.
+         */
+        virtual void on_fixation_end( gtl::Fixation const & fixation ) = 0;
+
+        /** Called for a saccade between two fixations, once the fixation it landed on has started.
+         *
+         * \param[in] saccade the complete saccade.
+         */
+        virtual void on_saccade( gtl::Saccade const & saccade ) = 0;
+    };
+
     /** \class ICalibrationResultListener
      *  Callback interface with methods associated to the changes of calibration result.
      *  This interface should be implemented by classes that are to recieve only changes in calibration result
@@ -112,6 +163,23 @@ namespace gtl
         virtual void on_calibration_result( bool is_calibrated, gtl::CalibResult const & calib_result ) = 0;
     };
 
+    /** \class IRequestHandler
+     *  Callback interface for the completion of non-blocking GazeApi requests, e.g. GazeApi::set_screen_async.
+     */
+    class IRequestHandler
+    {
+    public:
+        virtual ~IRequestHandler() {}
+
+        /** Called exactly once when a non-blocking request has completed, failed or timed out.
+         *  This is called from the thread receiving server messages, so implementations should return quickly.
+         *
+         * \param[in] request_id the id returned when the request was issued.
+         * \param[in] result outcome of the request.
+         */
+        virtual void on_request_completed( int request_id, gtl::GazeApiRequestResult result ) = 0;
+    };
+
     class IConnectionStateListener
     {
         /*
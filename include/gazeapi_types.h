@@ -10,6 +10,7 @@
 #ifndef _THEEYETRIBE_GAZEAPI_TYPES_H_
 #define _THEEYETRIBE_GAZEAPI_TYPES_H_
 
+#include <string>
 #include <vector>
 #include <cstring> // memcmp
 
@@ -45,6 +46,114 @@ namespace gtl
         GASC_TRACKER_STATE_CHANGE
     };
 
+    enum GazeApiRequestResult
+    {
+        GARR_OK,            ///< the server accepted the request
+        GARR_ERROR,         ///< the server rejected the request
+        GARR_TIMEOUT,       ///< no reply arrived in time
+        GARR_DISCONNECTED   ///< the connection closed before a reply arrived
+    };
+
+    enum GazeApiFrameDelivery
+    {
+        GAFD_ALL,       ///< deliver every gaze frame
+        GAFD_LATEST     ///< drop gaze frames superseded before they could be delivered
+    };
+
+    enum GazeApiThreadingMode
+    {
+        GATM_THREADED,  ///< the GazeApi reads and dispatches messages on its own threads
+        GATM_POLLED     ///< no internal threads; the application calls GazeApi::poll() or GazeApi::run_for()
+    };
+
+    /** Operating system handle of the connection's socket (a SOCKET on Windows, a file descriptor elsewhere). */
+#if defined( _WIN64 )
+    typedef unsigned __int64 GazeApiNativeHandle;
+#elif defined( _WIN32 )
+    typedef unsigned int GazeApiNativeHandle;
+#else
+    typedef int GazeApiNativeHandle;
+#endif
+
+    enum GazeApiListenerExecution
+    {
+        GALE_INLINE,    ///< the listener is called by the thread dispatching messages (default)
+        GALE_WORKER,    ///< the listener is called by a thread of its own
+        GALE_POOL       ///< the listener is called by a pool of threads shared with other GALE_POOL listeners
+    };
+
+    enum GazeApiThreadRole
+    {
+        GATR_IO,        ///< the thread reading from and writing to the socket
+        GATR_DISPATCH   ///< the thread calling listeners
+    };
+
+    /** Scheduling of a thread started by the GazeApi or a GazeRuntime. The defaults leave a thread as the system created it. */
+    struct GazeApiThreadOptions
+    {
+        GazeApiThreadOptions()
+            : cpu_mask( 0 )
+            , realtime_priority( 0 )
+            , nice( 0 )
+        {}
+
+        unsigned long long cpu_mask;    ///< bit n set allows running on core n; 0 leaves the affinity as it is
+        int realtime_priority;          ///< SCHED_FIFO priority from 1 (lowest) to 99 (time critical on Windows); -1 switches back to normal scheduling; 0 leaves it as it is
+        int nice;                       ///< nice value under normal scheduling, from -20 (highest priority) to 19 (lowest); 0 leaves it as it is
+        std::string name;               ///< name shown by debuggers and tools like top, truncated to 15 characters on Linux; empty leaves it as it is
+    };
+
+    enum GazeApiEventDetector
+    {
+        GAED_IVT,   ///< velocity threshold: slower gaze movement belongs to a fixation
+        GAED_IDT    ///< dispersion threshold: gaze staying within a small area belongs to a fixation
+    };
+
+    /** Parameters of the fixation and saccade detection, see GazeApi::set_event_options(). */
+    struct GazeApiEventOptions
+    {
+        GazeApiEventOptions()
+            : detector( GAED_IVT )
+            , viewing_distance( 0.6f )
+            , velocity_threshold( 30.0f )
+            , dispersion_threshold( 1.0f )
+            , min_fixation_duration( 100 )
+        {}
+
+        GazeApiEventDetector detector;  ///< algorithm used
+        float viewing_distance;         ///< distance from the eyes to the screen in meters
+        float velocity_threshold;       ///< GAED_IVT: gaze velocity in degrees per second above which a saccade is assumed
+        float dispersion_threshold;     ///< GAED_IDT: largest horizontal plus vertical extent of a fixation in degrees
+        int min_fixation_duration;      ///< shortest fixation in milliseconds; shorter ones are not reported
+    };
+
+    enum GazeApiFilter
+    {
+        GAF_NONE,       ///< raw coordinates are passed on as received (default)
+        GAF_ONE_EURO,   ///< One Euro filter: a low-pass filter whose cutoff frequency rises with the gaze speed
+        GAF_KALMAN      ///< Kalman filter with a constant velocity model
+    };
+
+    /** Smoothing of the raw gaze coordinates, see GazeApi::set_filter(). */
+    struct GazeApiFilterOptions
+    {
+        GazeApiFilterOptions()
+            : filter( GAF_NONE )
+            , min_cutoff( 1.0f )
+            , beta( 0.01f )
+            , derivative_cutoff( 1.0f )
+            , process_noise( 100000.0f )
+            , measurement_noise( 400.0f )
+        {}
+
+        GazeApiFilter filter;       ///< filter used
+        float min_cutoff;           ///< GAF_ONE_EURO: cutoff frequency in Hz while the gaze rests; lower values smooth more
+        float beta;                 ///< GAF_ONE_EURO: cutoff increase in Hz per pixel per second of gaze speed; higher values lag less
+        float derivative_cutoff;    ///< GAF_ONE_EURO: cutoff frequency in Hz of the gaze speed estimate
+        float process_noise;        ///< GAF_KALMAN: acceleration noise in pixels^2 per second^3; higher values lag less
+        float measurement_noise;    ///< GAF_KALMAN: variance of the raw coordinates in pixels^2; higher values smooth more
+    };
+
     struct Point2D
     {
         float x;    ///< x coordinate
@@ -168,6 +277,24 @@ namespace gtl
         }
     };
 
+    struct Fixation
+    {
+        int start;          ///< timestamp of the first sample, as in GazeData::time
+        int duration;       ///< duration in milliseconds, up to the latest sample
+        Point2D centroid;   ///< mean raw gaze coordinates in pixels
+        float dispersion;   ///< horizontal plus vertical extent in degrees of visual angle
+    };
+
+    struct Saccade
+    {
+        int start;              ///< timestamp of the last sample of the preceding fixation
+        int duration;           ///< time in milliseconds until the first sample of the following fixation
+        Point2D from;           ///< raw gaze coordinates in pixels where the saccade started
+        Point2D to;             ///< raw gaze coordinates in pixels where the saccade landed
+        float amplitude;        ///< angle between start and landing point in degrees
+        float peak_velocity;    ///< highest gaze velocity in degrees per second
+    };
+
     struct ServerState
     {
         enum
@@ -22,9 +22,16 @@
 #include "gazeapi_interfaces.h"
 #include "gazeapi_types.h"
 
+#include "gazeapi_events.hpp"
+#include "gazeapi_executor.hpp"
+#include "gazeapi_filter.hpp"
 #include "gazeapi_observable.hpp"
 #include "gazeapi_parser.hpp"
+#include "gazeapi_runtime.hpp"
 #include "gazeapi_socket.hpp"
+#include "gazeapi_snapshot.hpp"
+#include "gazeapi_history.hpp"
+#include "gazeapi_writer.hpp"
 
 #define BOOST_SPIRIT_THREADSAFE
 #include <boost/thread.hpp>
@@ -93,34 +100,120 @@ namespace gtl
     class GazeApi::Engine
         : public ISocketListener
         , Observable<IGazeListener>
+        , Observable<IGazeBatchListener>
+        , Observable<IGazeEventListener>
         , Observable<ICalibrationResultListener>
         , Observable<ITrackerStateListener>
         , Observable<ICalibrationProcessHandler>
         , Observable < IConnectionStateListener >
     {
     public:
-        using Observable<IGazeListener>::add_observer;
-        using Observable<IGazeListener>::remove_observer;
-        using Observable<ICalibrationResultListener>::add_observer;
-        using Observable<ICalibrationResultListener>::remove_observer;
-        using Observable<ITrackerStateListener>::add_observer;
-        using Observable<ITrackerStateListener>::remove_observer;
+        using Observable<IGazeBatchListener>::add_observer;
+        using Observable<IGazeBatchListener>::remove_observer;
+        using Observable<IGazeEventListener>::add_observer;
+        using Observable<IGazeEventListener>::remove_observer;
         using Observable<ICalibrationProcessHandler>::add_observer;
         using Observable<ICalibrationProcessHandler>::remove_observer;
         using Observable<IConnectionStateListener>::add_observer;
         using Observable<IConnectionStateListener>::remove_observer;
 
-        Engine( int verbose_level = 0 )
-            : m_socket( verbose_level )
+        Engine( int verbose_level = 0, GazeApiThreadingMode threading = GATM_THREADED )
+            : m_socket( verbose_level, threading == GATM_POLLED )
             , m_state( AS_STOPPED )
+            , m_filtering( false )
+            , m_request_id( 0 )
+            , m_shared_pool( 0 )
         {
+            m_gaze_batch.reserve( GAZE_BATCH_SIZE );
+            m_socket.add_observer( *this );
+        }
+
+        Engine( GazeRuntime::Impl & runtime, int verbose_level )
+            : m_socket( runtime.io_service(), runtime.dispatch_service(), verbose_level )
+            , m_state( AS_STOPPED )
+            , m_filtering( false )
+            , m_request_id( 0 )
+            , m_shared_pool( &runtime.dispatch_service() )
+        {
+            m_gaze_batch.reserve( GAZE_BATCH_SIZE );
             m_socket.add_observer( *this );
         }
 
         virtual ~Engine()
         {
             disconnect();
+
+            // Stop calling us before our members go away
+            m_socket.shutdown();
             m_socket.remove_observer( *this );
+
+            // Pool tasks of executors may outlive us, but must not call their listeners anymore. Removed
+            // executors were stopped already.
+            std::vector<boost::shared_ptr<ListenerExecutor> > executors;
+            {
+                boost::lock_guard<boost::mutex> lock( m_executor_lock );
+                executors = m_executors;
+            }
+
+            for( size_t i = 0; i < executors.size(); ++i )
+            {
+                executors[i]->stop();
+            }
+        }
+
+        // Register a listener that is called inline, or through a ListenerExecutor. Replaces any earlier
+        // registration of the same listener.
+        template <typename Listener>
+        void add_listener( Listener & listener, GazeApiListenerExecution const execution, std::size_t const capacity )
+        {
+            remove_listener( listener );
+
+            if( execution == GALE_INLINE )
+            {
+                Observable<Listener>::add_observer( listener );
+                return;
+            }
+
+            boost::lock_guard<boost::mutex> lock( m_executor_lock );
+            boost::shared_ptr<ListenerExecutor> const executor(
+                new ListenerExecutor( listener, execution == GALE_POOL ? &listener_pool() : 0, capacity ) );
+
+            executor->start();
+
+            // The observer lists keep the executor alive, so it is freed once no notification can reach it
+            m_executors.push_back( executor );
+            Observable<Listener>::add_observer( *executor, executor );
+        }
+
+        template <typename Listener>
+        void remove_listener( Listener & listener )
+        {
+            Observable<Listener>::remove_observer( listener );
+
+            std::vector<boost::shared_ptr<ListenerExecutor> > removed;
+            {
+                boost::lock_guard<boost::mutex> lock( m_executor_lock );
+                for( size_t i = 0; i < m_executors.size(); )
+                {
+                    if( m_executors[i]->calls( listener ) )
+                    {
+                        removed.push_back( m_executors[i] );
+                        m_executors.erase( m_executors.begin() + i );
+                    }
+                    else
+                    {
+                        ++i;
+                    }
+                }
+            }
+
+            // Outside the lock, as this waits for notifications and a call in progress, which may themselves
+            // add or remove listeners
+            for( size_t i = 0; i < removed.size(); ++i )
+            {
+                Observable<Listener>::remove_observer( *removed[i] );
+                removed[i]->stop();
+            }
         }
 
         bool is_running() const
@@ -137,7 +230,17 @@ namespace gtl
             }
             m_host = host;
             m_port = port;
-            m_sync_requests.clear();
+
+            {
+                boost::lock_guard<boost::mutex> lock( m_sync_lock );
+                m_sync_requests.clear();
+
+                // Fetches of a previous connection will not complete anymore
+                for( int i = 0; i < CK_COUNT; ++i )
+                {
+                    m_change_fetches[i].state = FS_IDLE;
+                }
+            }
 
             bool const success = m_socket.connect( m_host, m_port );
 
@@ -146,17 +249,32 @@ namespace gtl
                 m_state = AS_RUNNING;
 
                 memset( &m_server_proxy, 0, sizeof( ServerState ) );
-                memset( &m_gaze_data, 0, sizeof( GazeData ) );
-                memset( &m_screen, 0, sizeof( Screen ) );
-                m_calib_result.clear();
+                GazeData gaze_data;
+                memset( &gaze_data, 0, sizeof( GazeData ) );
+                m_gaze_data.store( gaze_data );
+                m_gaze_history.clear();
 
-                // Is this SDK version supported by the server?
-                if( get_default_version() < VERSION )
                 {
-                    disconnect();
-                    return false;
+                    boost::lock_guard<boost::mutex> lock( m_filter_lock );
+                    m_gaze_filter.reset();
+                }
+
+                {
+                    boost::lock_guard<boost::mutex> lock( m_event_lock );
+                    m_event_detector.reset();
                 }
 
+                Screen screen;
+                memset( &screen, 0, sizeof( Screen ) );
+                m_screen.store( screen );
+
+                m_calib_result.store( CalibResult() );
+
+                // The start-up requests are pipelined: the version query, setting our version and
+                // retrieving the current state all go out at once, so connecting costs about one round
+                // trip. Should the server turn out to be too old we simply disconnect again.
+                request_default_version();
+
                 // Version 1: Initial version of C++ SDK uses a hacky way to synchronize API calls.
                 //            EyeTribe server supported: all versions
                 // Version 2: Optional id added to all API calls,
@@ -164,20 +282,26 @@ namespace gtl
                 //            EyeTribe server supported: from v0.9.53
                 //
                 // Set version 2
-                if( !set_version( VERSION ) )
+                int const version_id = request_set_version( VERSION );
+
+                // retrieve current state
+                int const state_id = request_tracker_state();
+
+                // Is this SDK version supported by the server?
+                Message reply;
+                if( wait_default_version() < VERSION || !end_request( version_id, reply ) || !reply.is( GASC_OK ) )
                 {
                     disconnect();
                     return false;
                 }
 
-                Observable<IConnectionStateListener>::ObserverVector const & observers = Observable<IConnectionStateListener>::get_observers();
+                Observable<IConnectionStateListener>::ObserverVector const observers = Observable<IConnectionStateListener>::get_observers();
                 for( size_t i = 0; i < observers.size(); ++i )
                 {
                     observers[i]->on_connection_state_changed( true );
                 }
 
-                // retrieve current state
-                get_tracker_state();
+                end_request( state_id, reply );
             }
 
             return success;
@@ -193,83 +317,135 @@ namespace gtl
             {
                 m_state = AS_STOPPED;
                 m_socket.disconnect();
+                fail_async_requests( GARR_DISCONNECTED );
+
+                boost::lock_guard<boost::mutex> lock( m_version_lock );
+                m_version_received.notify_all();
             }
         }
 
-        // This method is backwards compatible with all versions of the server API
-        int get_default_version()
+        // These methods are backwards compatible with all versions of the server API
+        void request_default_version()
         {
-            int version = m_server_proxy.version;
-            m_server_proxy.version = 0;
+            {
+                boost::lock_guard<boost::mutex> lock( m_version_lock );
+                m_server_proxy.version = 0;
+            }
             send_async( "{\"category\":\"tracker\",\"request\":\"get\",\"values\":[\"version\"]}" );
-            size_t wait = 5000; // 5 secs
-            while( m_server_proxy.version == 0 && wait > 0 )
+        }
+
+        int wait_default_version()
+        {
+            boost::chrono::steady_clock::time_point const deadline = boost::chrono::steady_clock::now() + boost::chrono::seconds( 5 );
+
+            if( m_socket.is_polled() )
             {
-                boost::this_thread::sleep( boost::posix_time::milliseconds( 1 ) );
-                --wait;
+                // The reply has no id, so it is only seen once dispatched; without a dispatch thread do that here
+                while( m_state != AS_STOPPED && get_server_version() == 0 )
+                {
+                    boost::chrono::milliseconds const remaining = boost::chrono::duration_cast<boost::chrono::milliseconds>( deadline - boost::chrono::steady_clock::now() );
+                    if( remaining.count() <= 0 )
+                    {
+                        break;
+                    }
+                    m_socket.run_for( static_cast<unsigned int>( remaining.count() ) );
+                }
+                return get_server_version();
+            }
+
+            boost::unique_lock<boost::mutex> lock( m_version_lock );
+            while( m_server_proxy.version == 0 && m_state != AS_STOPPED )
+            {
+                if( m_version_received.wait_until( lock, deadline ) == boost::cv_status::timeout )
+                {
+                    break;
+                }
             }
-            std::swap( version, m_server_proxy.version );
-            return version;
+            return m_server_proxy.version;
+        }
+
+        int get_server_version()
+        {
+            boost::lock_guard<boost::mutex> lock( m_version_lock );
+            return m_server_proxy.version;
         }
 
-        bool set_version( size_t const version )
+        int request_set_version( size_t const version )
         {
-            std::stringstream ss;
-            ss << "{\"id\":" << SR_SET_VERSION << ",\"category\":\"tracker\",\"request\":\"set\",\"values\":" << "{\"version\":" << version << "}}";
-            send_sync( ss.str() );
-            return m_sync_requests[SR_SET_VERSION].is( GASC_OK );
+            int const id = begin_request();
+            RequestWriter request;
+            request.begin( id, "tracker", "set" ).raw( ",\"values\":{\"version\":" ).integer( version ).raw( "}}" );
+            send_request( id, request );
+            return id;
         }
 
         bool set_screen( Screen const & screen )
         {
-            std::stringstream ss;
-            ss << "{\"id\":" << SR_SET_SCREEN << ",\"category\":\"tracker\",\"request\":\"set\",\"values\":" << "{\"screenindex\":" << screen.screenindex << ",\"screenresw\":" << screen.screenresw << ",\"screenresh\":" << screen.screenresh << ",\"screenpsyw\":" << screen.screenpsyw << ",\"screenpsyh\":" << screen.screenpsyh << "}}";
-            send_sync( ss.str() );
-            return m_sync_requests[SR_SET_SCREEN].is( GASC_OK );
+            int const id = begin_request();
+            Message reply;
+            return send_sync( id, set_screen_request( id, screen ), reply ) && reply.is( GASC_OK );
+        }
+
+        int set_screen_async( Screen const & screen, IRequestHandler * handler, unsigned int const timeout_ms )
+        {
+            int const id = begin_async_request( handler );
+            return send_async_request( id, set_screen_request( id, screen ), timeout_ms );
+        }
+
+        void set_frame_delivery( GazeApiFrameDelivery const delivery )
+        {
+            m_socket.set_frame_coalescing( delivery == GAFD_LATEST );
+        }
+
+        bool set_thread_options( GazeApiThreadRole const role, GazeApiThreadOptions const & options )
+        {
+            return m_socket.set_thread_options( role, options );
+        }
+
+        std::size_t poll()
+        {
+            return m_socket.is_polled() ? m_socket.poll() : 0;
+        }
+
+        std::size_t run_for( unsigned int const timeout_ms )
+        {
+            return m_socket.is_polled() ? m_socket.run_for( timeout_ms ) : 0;
+        }
+
+        GazeApiNativeHandle native_handle()
+        {
+            return static_cast<GazeApiNativeHandle>( m_socket.native_handle() );
+        }
+
+        void set_filter( GazeApiFilterOptions const & options )
+        {
+            boost::lock_guard<boost::mutex> lock( m_filter_lock );
+            m_gaze_filter.set_options( options );
+            m_filtering.store( options.filter != GAF_NONE, boost::memory_order_relaxed );
+        }
+
+        void set_event_options( GazeApiEventOptions const & options )
+        {
+            boost::lock_guard<boost::mutex> lock( m_event_lock );
+            m_event_detector.set_options( options );
         }
 
         void get_screen( Screen & screen ) const
         {
-            m_screen_lock.lock();
-            screen = m_screen;
-            m_screen_lock.unlock();
+            m_screen.load( screen );
         }
 
         void get_tracker_state()
         {
-            // request everything
-            std::stringstream ss;
-            ss << "{\"id\":" << SR_GET_TRACKER_STATE << ","
-                << "\"category\":\"tracker\",\"request\":\"get\",\"values\":["
-                << "\"version\","
-                << "\"trackerstate\","
-                << "\"framerate\","
-                << "\"iscalibrated\","
-                << "\"iscalibrating\","
-                << "\"calibresult\","
-                << "\"frame\","
-                << "\"screenindex\","
-                << "\"screenresw\","
-                << "\"screenresh\","
-                << "\"screenpsyw\","
-                << "\"screenpsyh\""
-                << "]}";
-         
-           send_sync( ss.str() );
-        }
-
-        void get_frame( GazeData & gaze_data )
-        {
-            m_gaze_lock.lock();
-            gaze_data = m_gaze_data;
-            m_gaze_lock.unlock();
+            Message reply;
+            end_request( request_tracker_state(), reply );
         }
 
-        void get_calib_result( CalibResult & calib_result ) const
+        int request_tracker_state()
         {
-            m_calib_lock.lock();
-            calib_result = m_calib_result;
-            m_calib_lock.unlock();
+            int const id = begin_request();
+            send_request( id, tracker_state_request( id ) );
+            return id;
         }
 
         ServerState const & update_server_state()
@@ -278,18 +454,50 @@ namespace gtl
             return m_server_proxy;
         }
 
+        int update_server_state_async( IRequestHandler * handler, unsigned int const timeout_ms )
+        {
+            int const id = begin_async_request( handler );
+            return send_async_request( id, tracker_state_request( id ), timeout_ms );
+        }
+
         ServerState const & get_server_state() const
         {
             return m_server_proxy;
         }
 
+        void get_frame( GazeData & gaze_data ) const
+        {
+            m_gaze_data.load( gaze_data );
+        }
+
+        std::size_t get_last_frames( std::size_t const count, std::vector<GazeData> & frames ) const
+        {
+            return m_gaze_history.copy_last( count, frames );
+        }
+
+        std::size_t get_frames_since( int const time, std::vector<GazeData> & frames ) const
+        {
+            return m_gaze_history.copy_since( time, frames );
+        }
+
+        void get_calib_result( CalibResult & calib_result ) const
+        {
+            m_calib_result.load( calib_result );
+        }
+
         bool calibration_start( int const point_count )
         {
             m_calibration_proxy.start_calibration( point_count );
-            std::stringstream ss;
-            ss << "{\"id\":" << SR_CALIB_START << ",\"category\":\"calibration\",\"request\":\"start\",\"values\":{\"pointcount\":" << point_count << "}}";
-            send_sync( ss.str() );
-            return m_sync_requests[SR_CALIB_START].is( GASC_OK );
+            int const id = begin_request();
+            Message reply;
+            return send_sync( id, calibration_start_request( id, point_count ), reply ) && reply.is( GASC_OK );
+        }
+
+        int calibration_start_async( int const point_count, IRequestHandler * handler, unsigned int const timeout_ms )
+        {
+            m_calibration_proxy.start_calibration( point_count );
+            int const id = begin_async_request( handler );
+            return send_async_request( id, calibration_start_request( id, point_count ), timeout_ms );
         }
 
         void calibration_clear()
@@ -304,10 +512,15 @@ namespace gtl
 
         bool calibration_point_start( int const x, int const y )
         {
-            std::stringstream ss;
-            ss << "{\"id\":" << SR_CALIB_POINT_START << ",\"category\":\"calibration\",\"request\":\"pointstart\",\"values\":{\"x\":" << x << ",\"y\":" << y << "}}";
-            send_sync( ss.str() );
-            return m_sync_requests[SR_CALIB_POINT_START].is( GASC_OK );
+            int const id = begin_request();
+            Message reply;
+            return send_sync( id, calibration_point_start_request( id, x, y ), reply ) && reply.is( GASC_OK );
+        }
+
+        int calibration_point_start_async( int const x, int const y, IRequestHandler * handler, unsigned int const timeout_ms )
+        {
+            int const id = begin_async_request( handler );
+            return send_async_request( id, calibration_point_start_request( id, x, y ), timeout_ms );
         }
 
         void calibration_point_end()
@@ -315,7 +528,7 @@ namespace gtl
             send_async( "{\"category\":\"calibration\",\"request\":\"pointend\"}" );
         }
 
-        void on_message( std::string const & message )
+        void on_message( ReceivedMessage const & message )
         {
             try
             {
@@ -323,7 +536,12 @@ namespace gtl
                 parse( msg, message );
                 if( msg.has_id() )
                 {
-                    m_sync_requests[msg.m_id] = msg;
+                    boost::lock_guard<boost::mutex> lock( m_sync_lock );
+                    std::map<int, Message>::iterator it = m_sync_requests.find( msg.m_id );
+                    if( it != m_sync_requests.end() )
+                    {
+                        it->second = msg;
+                    }
                 }
             }
             catch( std::exception const & e )
@@ -332,11 +550,44 @@ namespace gtl
             }
         }
 
+        void on_request_completed( int id, bool replied )
+        {
+            if( complete_change_fetch( id ) )
+            {
+                return;
+            }
+
+            IRequestHandler * handler = 0;
+            Message reply;
+            {
+                boost::lock_guard<boost::mutex> lock( m_sync_lock );
+                std::map<int, IRequestHandler *>::iterator it = m_async_requests.find( id );
+                if( it == m_async_requests.end() )
+                {
+                    return; // A blocking request, collected by end_request()
+                }
+                handler = it->second;
+                m_async_requests.erase( it );
+
+                std::map<int, Message>::iterator msg = m_sync_requests.find( id );
+                if( msg != m_sync_requests.end() )
+                {
+                    reply = msg->second;
+                    m_sync_requests.erase( msg );
+                }
+            }
+
+            if( handler )
+            {
+                handler->on_request_completed( id, !replied ? GARR_TIMEOUT : reply.is( GASC_OK ) ? GARR_OK : GARR_ERROR );
+            }
+        }
+
         void on_disconnected()
         {
             disconnect();
 
-            Observable<IConnectionStateListener>::ObserverVector const & observers = Observable<IConnectionStateListener>::get_observers();
+            Observable<IConnectionStateListener>::ObserverVector const observers = Observable<IConnectionStateListener>::get_observers();
             for( size_t i = 0; i < observers.size(); ++i )
             {
                 observers[i]->on_connection_state_changed( false );
@@ -346,6 +597,25 @@ namespace gtl
 
     private:
 
+        // Kinds of server notification, each followed up by fetching what changed
+        enum ChangeKind { CK_CALIBRATION, CK_DISPLAY, CK_TRACKER_STATE, CK_COUNT };
+
+        // A fetch is pending until its reply has been handled. A notification arriving meanwhile makes it dirty.
+        enum FetchState { FS_IDLE, FS_PENDING, FS_PENDING_DIRTY };
+
+        struct ChangeFetch
+        {
+            ChangeFetch()
+                : state( FS_IDLE )
+                , id( -1 )
+            {}
+
+            FetchState  state;
+            int         id;
+        };
+
+        enum { CHANGE_FETCH_TIMEOUT_MS = 5000 };
+
         struct Message
         {
             Message()
@@ -396,39 +666,175 @@ namespace gtl
 
     private:
 
-        void send_sync( std::string const & message )
+        static RequestWriter set_screen_request( int const id, Screen const & screen )
+        {
+            RequestWriter request;
+            request.begin( id, "tracker", "set" )
+                .raw( ",\"values\":{\"screenindex\":" ).integer( screen.screenindex )
+                .raw( ",\"screenresw\":" ).integer( screen.screenresw )
+                .raw( ",\"screenresh\":" ).integer( screen.screenresh )
+                .raw( ",\"screenpsyw\":" ).number( screen.screenpsyw )
+                .raw( ",\"screenpsyh\":" ).number( screen.screenpsyh )
+                .raw( "}}" );
+            return request;
+        }
+
+        static RequestWriter tracker_state_request( int const id )
+        {
+            // request everything
+            RequestWriter request;
+            request.begin( id, "tracker", "get" )
+                .raw( ",\"values\":[" )
+                .raw( "\"version\"," )
+                .raw( "\"trackerstate\"," )
+                .raw( "\"framerate\"," )
+                .raw( "\"iscalibrated\"," )
+                .raw( "\"iscalibrating\"," )
+                .raw( "\"calibresult\"," )
+                .raw( "\"frame\"," )
+                .raw( "\"screenindex\"," )
+                .raw( "\"screenresw\"," )
+                .raw( "\"screenresh\"," )
+                .raw( "\"screenpsyw\"," )
+                .raw( "\"screenpsyh\"" )
+                .raw( "]}" );
+            return request;
+        }
+
+        static RequestWriter calibration_start_request( int const id, int const point_count )
+        {
+            RequestWriter request;
+            request.begin( id, "calibration", "start" ).raw( ",\"values\":{\"pointcount\":" ).integer( point_count ).raw( "}}" );
+            return request;
+        }
+
+        static RequestWriter calibration_point_start_request( int const id, int const x, int const y )
+        {
+            RequestWriter request;
+            request.begin( id, "calibration", "pointstart" ).raw( ",\"values\":{\"x\":" ).integer( x ).raw( ",\"y\":" ).integer( y ).raw( "}}" );
+            return request;
+        }
+
+        int begin_request()
+        {
+            int const id = ++m_request_id;
+            boost::lock_guard<boost::mutex> lock( m_sync_lock );
+            m_sync_requests[id].reset();
+            return id;
+        }
+
+        bool send_request( int const id, RequestWriter const & request )
+        {
+            return m_state != AS_STOPPED && request.ok() && m_socket.send_request( id, request.data(), request.size() );
+        }
+
+        // Waits for the reply to request 'id'. Returns false if no reply was received.
+        bool end_request( int const id, Message & reply )
+        {
+            bool const completed = m_state != AS_STOPPED && m_socket.wait_request( id );
+
+            boost::lock_guard<boost::mutex> lock( m_sync_lock );
+            std::map<int, Message>::iterator it = m_sync_requests.find( id );
+            if( it != m_sync_requests.end() )
+            {
+                reply = it->second;
+                m_sync_requests.erase( it );
+            }
+            return completed;
+        }
+
+        bool send_sync( int const id, RequestWriter const & request, Message & reply )
+        {
+            send_request( id, request );
+            return end_request( id, reply );
+        }
+
+        // Reserves a new request id whose completion is reported to 'handler' (which may be null)
+        int begin_async_request( IRequestHandler * handler )
+        {
+            int const id = begin_request();
+            boost::lock_guard<boost::mutex> lock( m_sync_lock );
+            m_async_requests[id] = handler;
+            return id;
+        }
+
+        int send_async_request( int const id, RequestWriter const & request, unsigned int const timeout_ms )
         {
-            int const id = m_socket.get_id( message );
-            if( m_state != AS_STOPPED && id != -1 )
+            if( m_state != AS_STOPPED && request.ok() && m_socket.send_request( id, request.data(), request.size(), timeout_ms ) )
             {
-                m_sync_lock.lock();
-                Message & msg = m_sync_requests[id];
-                msg.reset();
-                m_socket.send_sync( message );
-                m_sync_lock.unlock();
+                return id;
             }
+
+            boost::lock_guard<boost::mutex> lock( m_sync_lock );
+            m_async_requests.erase( id );
+            m_sync_requests.erase( id );
+            return -1;
         }
 
-        void send_async( std::string const & message )
+        void fail_async_requests( GazeApiRequestResult const result )
+        {
+            std::map<int, IRequestHandler *> requests;
+            {
+                boost::lock_guard<boost::mutex> lock( m_sync_lock );
+                requests.swap( m_async_requests );
+
+                std::map<int, IRequestHandler *>::const_iterator it = requests.begin();
+                for( ; it != requests.end(); ++it )
+                {
+                    m_sync_requests.erase( it->first );
+                }
+            }
+
+            std::map<int, IRequestHandler *>::const_iterator it = requests.begin();
+            for( ; it != requests.end(); ++it )
+            {
+                if( it->second )
+                {
+                    it->second->on_request_completed( it->first, result );
+                }
+            }
+        }
+
+        void send_async( char const * message )
         {
             if( m_state != AS_STOPPED )
             {
-                m_socket.send( message );
+                m_socket.send( message, strlen( message ) );
             }
         }
 
-        void parse( Message & reply, std::string const & json_message )
+        void parse( Message & reply, ReceivedMessage const & message )
         {
-            boost::property_tree::ptree root;
+            char const * const begin = message.text.data();
+            char const * const end = begin + message.text.size();
+
+            // Pushed gaze frames are decoded straight from the message bytes. Those recognized while framing
+            // only need their frame object read; other messages without id are checked in full.
+            if( message.id == -1 )
             {
-                std::stringstream ss( json_message );
-                boost::property_tree::read_json( ss, root );
+                GazeData gaze_data;
+                bool const is_frame = message.kind == MK_FRAME_PUSH ?
+                    Parser::parse_frame_push( gaze_data, begin + message.payload, end ) :
+                    Parser::parse_frame_message( gaze_data, begin, end );
+
+                if( is_frame )
+                {
+                    reply = Message();
+                    reply.m_category = GAC_TRACKER;
+                    reply.m_request = GAR_GET;
+                    reply.m_statuscode = GASC_OK;
+                    update_gaze_data( gaze_data, true );
+                    return;
+                }
             }
 
+            boost::property_tree::ptree root;
+            Parser::read_json( root, begin, end );
+
             reply = Message();
 
-            // Parse message id and description if present
-            Parser::parse_id( reply.m_id, root );
+            // Parse description if present
+            reply.m_id = message.id;
             Parser::parse_description( reply.m_description, root );
 
             if( !Parser::parse_category( reply.m_category, root ) )
@@ -451,33 +857,13 @@ namespace gtl
             // If message is notification we do not care about the request-part
             if( reply.is_notification() )
             {
-                std::string values;
                 switch( reply.m_statuscode )
                 {
-                    case GASC_CALIBRATION_CHANGE:
-                    {
-                        // initiate request for calibration data
-                        values = "\"calibresult\",\"iscalibrated\",\"iscalibrating\"";
-                        break;
-                    }
-                    case GASC_DISPLAY_CHANGE:
-                    {
-                        // initiate request for display index
-                        values = "\"screenindex\",\"screenresw\",\"screenresh\",\"screenpsyw\",\"screenpsyh\"";
-                        break;
-                    }
-                    case GASC_TRACKER_STATE_CHANGE:
-                    {
-                        // initiate request for tracker state
-                        values = "\"trackerstate\"";
-                        break;
-                    }
+                    case GASC_CALIBRATION_CHANGE: fetch_changes( CK_CALIBRATION ); break;
+                    case GASC_DISPLAY_CHANGE: fetch_changes( CK_DISPLAY ); break;
+                    case GASC_TRACKER_STATE_CHANGE: fetch_changes( CK_TRACKER_STATE ); break;
                     default: break;
                 }
-
-                std::stringstream ss;
-                ss << "{\"id\":" << SR_GET_CHANGES << ",\"category\":\"tracker\",\"request\":\"get\",\"values\":[" << values << "]}";
-                send_sync( ss.str() );
                 return;
             }
 
@@ -503,7 +889,8 @@ namespace gtl
                     CalibResult calib_result;
 
                     ServerState server_state = m_server_proxy;
-                    Screen screen = m_screen;
+                    Screen const current_screen = m_screen.load();
+                    Screen screen = current_screen;
 
                     if( !Parser::parse_server_state( server_state, gaze_data, calib_result, screen, root, has_gaze_data, has_calib_result ) )
                     {
@@ -511,60 +898,55 @@ namespace gtl
                     }
 
                     bool const has_state_changed = server_state.trackerstate != m_server_proxy.trackerstate;
+                    bool const has_version_changed = server_state.version != m_server_proxy.version;
 
-                    // Update everything
-                    m_server_proxy = server_state;
-
-                    if( has_gaze_data )
+                    // Update everything, under the lock wait_default_version() reads the version with
                     {
-                        m_gaze_lock.lock();
-                        m_gaze_data = gaze_data;
-                        m_gaze_lock.unlock();
-
-                        // There was gaze data present, so
-                        typedef Observable<IGazeListener> ObservableType;
-                        ObservableType::ObserverVector const & observers = ObservableType::get_observers();
+                        boost::lock_guard<boost::mutex> lock( m_version_lock );
+                        m_server_proxy = server_state;
 
-                        for( size_t i = 0; i < observers.size(); ++i )
+                        if( has_version_changed )
                         {
-                            observers[i]->on_gaze_data( m_gaze_data );
+                            m_version_received.notify_all();
                         }
                     }
 
+                    if( has_gaze_data )
+                    {
+                        // Only messages without id are guaranteed to come from the dispatch thread
+                        update_gaze_data( gaze_data, !reply.has_id() );
+                    }
+
                     if( has_calib_result )
                     {
-                        m_calib_lock.lock();
-                        m_calib_result = calib_result;
-                        m_calib_lock.unlock();
+                        m_calib_result.store( calib_result );
 
                         typedef Observable<ICalibrationResultListener> ObservableType;
-                        ObservableType::ObserverVector const & observers = ObservableType::get_observers();
+                        ObservableType::ObserverVector const observers = ObservableType::get_observers();
 
                         for( size_t i = 0; i < observers.size(); ++i )
                         {
-                            observers[i]->on_calibration_changed( m_calib_result.result, m_calib_result );
+                            observers[i]->on_calibration_changed( calib_result.result, calib_result );
                         }
                     }
 
-                    if( screen != m_screen )
+                    if( screen != current_screen )
                     {
-                        m_screen_lock.lock();
-                        m_screen = screen;
-                        m_screen_lock.unlock();
+                        m_screen.store( screen );
 
                         typedef Observable<ITrackerStateListener> ObservableType;
-                        ObservableType::ObserverVector const & observers = ObservableType::get_observers();
+                        ObservableType::ObserverVector const observers = ObservableType::get_observers();
 
                         for( size_t i = 0; i < observers.size(); ++i )
                         {
-                            observers[i]->on_screen_state_changed( m_screen );
+                            observers[i]->on_screen_state_changed( screen );
                         }
                     }
 
                     if( has_state_changed )
                     {
                         typedef Observable<ITrackerStateListener> ObservableType;
-                        ObservableType::ObserverVector const & observers = ObservableType::get_observers();
+                        ObservableType::ObserverVector const observers = ObservableType::get_observers();
 
                         for( size_t i = 0; i < observers.size(); ++i )
                         {
@@ -580,7 +962,7 @@ namespace gtl
                 if( reply.is( GAR_START ) )
                 {
                     typedef Observable<ICalibrationProcessHandler> ObservableType;
-                    ObservableType::ObserverVector const & observers = ObservableType::get_observers();
+                    ObservableType::ObserverVector const observers = ObservableType::get_observers();
 
                     for( size_t i = 0; i < observers.size(); ++i )
                     {
@@ -595,7 +977,7 @@ namespace gtl
                     double progress = m_calibration_proxy.get_progress();
 
                     typedef Observable<ICalibrationProcessHandler> ObservableType;
-                    ObservableType::ObserverVector const & observers = ObservableType::get_observers();
+                    ObservableType::ObserverVector const observers = ObservableType::get_observers();
 
                     for( size_t i = 0; i < observers.size(); ++i )
                     {
@@ -613,23 +995,21 @@ namespace gtl
                     {
                         if( calib_result.result )
                         {
-                            m_calib_lock.lock();
-                            m_calib_result = calib_result;
-                            m_calib_lock.unlock();
+                            m_calib_result.store( calib_result );
 
                             typedef Observable<ICalibrationResultListener> ObservableType;
-                            ObservableType::ObserverVector const & observers = ObservableType::get_observers();
+                            ObservableType::ObserverVector const observers = ObservableType::get_observers();
 
                             for( size_t i = 0; i < observers.size(); ++i )
                             {
-                                observers[i]->on_calibration_changed( m_calib_result.result, m_calib_result );
+                                observers[i]->on_calibration_changed( calib_result.result, calib_result );
                             }
 
                             m_calibration_proxy.clear();
                         }
 
                         typedef Observable<ICalibrationProcessHandler> ObservableType;
-                        ObservableType::ObserverVector const & observers = ObservableType::get_observers();
+                        ObservableType::ObserverVector const observers = ObservableType::get_observers();
 
                         for( size_t i = 0; i < observers.size(); ++i )
                         {
@@ -645,12 +1025,206 @@ namespace gtl
 
                 if( reply.is( GAR_CLEAR ) )
                 {
-                    m_calib_lock.lock();
-                    m_calib_result.clear();
-                    m_calib_lock.unlock();
+                    m_calib_result.store( CalibResult() );
+                }
+
+            }
+        }
+
+        // Requests what a notification reported as changed, without waiting for the reply; parse() handles it
+        // like any other reply. While a fetch of the same kind is pending, the notification only marks it dirty.
+        void fetch_changes( ChangeKind const kind )
+        {
+            {
+                boost::lock_guard<boost::mutex> lock( m_sync_lock );
+                ChangeFetch & fetch = m_change_fetches[kind];
+
+                if( fetch.state != FS_IDLE )
+                {
+                    fetch.state = FS_PENDING_DIRTY;
+                    return;
+                }
+                fetch.state = FS_PENDING;
+            }
+
+            send_change_fetch( kind );
+        }
+
+        void send_change_fetch( ChangeKind const kind )
+        {
+            static char const * const values[ CK_COUNT ] =
+            {
+                "\"calibresult\",\"iscalibrated\",\"iscalibrating\"",
+                "\"screenindex\",\"screenresw\",\"screenresh\",\"screenpsyw\",\"screenpsyh\"",
+                "\"trackerstate\""
+            };
+
+            int const id = begin_async_request( 0 );
+            {
+                boost::lock_guard<boost::mutex> lock( m_sync_lock );
+                m_change_fetches[kind].id = id;
+            }
+
+            RequestWriter request;
+            request.begin( id, "tracker", "get" ).raw( ",\"values\":[" ).raw( values[kind] ).raw( "]}" );
+
+            if( send_async_request( id, request, CHANGE_FETCH_TIMEOUT_MS ) < 0 )
+            {
+                boost::lock_guard<boost::mutex> lock( m_sync_lock );
+                m_change_fetches[kind].state = FS_IDLE;
+            }
+        }
+
+        // Returns false if 'id' is not a change fetch. A dirty fetch is followed by another one, as its reply
+        // may predate the latest change.
+        bool complete_change_fetch( int const id )
+        {
+            int kind = 0;
+            bool refetch = false;
+            {
+                boost::lock_guard<boost::mutex> lock( m_sync_lock );
+                while( kind < CK_COUNT && ( m_change_fetches[kind].state == FS_IDLE || m_change_fetches[kind].id != id ) )
+                {
+                    ++kind;
+                }
+
+                if( kind == CK_COUNT )
+                {
+                    return false;
+                }
+
+                ChangeFetch & fetch = m_change_fetches[kind];
+                refetch = fetch.state == FS_PENDING_DIRTY;
+                fetch.state = refetch ? FS_PENDING : FS_IDLE;
+
+                m_async_requests.erase( id );
+                m_sync_requests.erase( id );
+            }
+
+            if( refetch && m_state != AS_STOPPED )
+            {
+                send_change_fetch( static_cast<ChangeKind>( kind ) );
+            }
+            return true;
+        }
+
+        // Frames from the dispatch thread are collected and handed to batch listeners once the queue has been
+        // drained. Any other frame, i.e. one carried by a reply, is dispatched ahead of the queue and could
+        // overtake pushed frames still in it, so batch listeners do not get it. With a filter set, frames are
+        // filtered before anything else sees them.
+        void update_gaze_data( GazeData const & received, bool const batch )
+        {
+            GazeData filtered;
+            GazeData const & gaze_data = filter_gaze_data( received, filtered );
+
+            m_gaze_data.store( gaze_data );
+            m_gaze_history.push( gaze_data );
+
+            typedef Observable<IGazeListener> ObservableType;
+            ObservableType::ObserverVector const observers = ObservableType::get_observers();
+
+            for( size_t i = 0; i < observers.size(); ++i )
+            {
+                observers[i]->on_gaze_data( gaze_data );
+            }
+
+            if( Observable<IGazeEventListener>::size() != 0 )
+            {
+                detect_events( gaze_data );
+            }
+
+            if( !batch || Observable<IGazeBatchListener>::size() == 0 )
+            {
+                return;
+            }
+
+            m_gaze_batch.push_back( gaze_data );
+
+            if( m_gaze_batch.size() == GAZE_BATCH_SIZE )
+            {
+                on_messages_drained();
+            }
+        }
+
+        void on_messages_drained()
+        {
+            if( !m_gaze_batch.empty() )
+            {
+                deliver_gaze_batch( &m_gaze_batch[0], m_gaze_batch.size() );
+                m_gaze_batch.clear();
+            }
+        }
+
+        void deliver_gaze_batch( GazeData const * frames, std::size_t const count )
+        {
+            typedef Observable<IGazeBatchListener> ObservableType;
+            ObservableType::ObserverVector const observers = ObservableType::get_observers();
+
+            for( size_t i = 0; i < observers.size(); ++i )
+            {
+                observers[i]->on_gaze_data_batch( frames, count );
+            }
+        }
+
+        GazeData const & filter_gaze_data( GazeData const & received, GazeData & filtered )
+        {
+            if( !m_filtering.load( boost::memory_order_relaxed ) )
+            {
+                return received;
+            }
+
+            filtered = received;
+
+            boost::lock_guard<boost::mutex> lock( m_filter_lock );
+            m_gaze_filter.apply( filtered );
+            return filtered;
+        }
+
+        // Listeners are called outside m_event_lock, so that they may change the options
+        void detect_events( GazeData const & gaze_data )
+        {
+            GazeEvent events[ GazeEventDetector::MAX_EVENTS ];
+            std::size_t count;
+            {
+                boost::lock_guard<boost::mutex> lock( m_event_lock );
+                count = m_event_detector.process( gaze_data, m_screen.load(), events );
+            }
+
+            if( count == 0 )
+            {
+                return;
+            }
+
+            typedef Observable<IGazeEventListener> ObservableType;
+            ObservableType::ObserverVector const observers = ObservableType::get_observers();
+
+            for( size_t e = 0; e < count; ++e )
+            {
+                for( size_t i = 0; i < observers.size(); ++i )
+                {
+                    switch( events[e].kind )
+                    {
+                        case GazeEvent::FIXATION_START: observers[i]->on_fixation_start( events[e].fixation ); break;
+                        case GazeEvent::FIXATION_END: observers[i]->on_fixation_end( events[e].fixation ); break;
+                        case GazeEvent::SACCADE: observers[i]->on_saccade( events[e].saccade ); break;
+                    }
                 }
+            }
+        }
+
+        // Must be called with m_executor_lock held
+        boost::asio::io_service & listener_pool()
+        {
+            if( m_shared_pool )
+            {
+                return *m_shared_pool;
+            }
 
+            if( !m_listener_pool )
+            {
+                m_listener_pool.reset( new ThreadPool( LISTENER_POOL_THREADS ) );
             }
+            return m_listener_pool->service();
         }
 
     private:
@@ -659,18 +1233,12 @@ namespace gtl
         enum ApiVersion { VERSION = 2 };
 
         enum ApiState { AS_STOPPED, AS_RUNNING, AS_ISCALIBRATING };
-        enum
-        {
-            SR_ERROR                = 1 << 0,
-            SR_GET_TRACKER_STATE    = 1 << 1,
-            SR_GET_FRAME            = 1 << 2,
-            SR_GET_CALIB_RESULT     = 1 << 3,
-            SR_GET_CHANGES          = 1 << 4,
-            SR_SET_VERSION          = 1 << 5,
-            SR_SET_SCREEN           = 1 << 7,
-            SR_CALIB_START          = 1 << 8,
-            SR_CALIB_POINT_START    = 1 << 9,
-        };
+
+        // Largest number of frames handed to IGazeBatchListener at once
+        enum { GAZE_BATCH_SIZE = 128 };
+
+        // Threads calling GALE_POOL listeners, unless running on a GazeRuntime
+        enum { LISTENER_POOL_THREADS = 2 };
 
         Socket                  m_socket;
         ApiState                m_state;
@@ -679,19 +1247,38 @@ namespace gtl
         std::string             m_host;
 
         ServerState             m_server_proxy;
-        GazeData                m_gaze_data;
-        CalibResult             m_calib_result;
-        Screen                  m_screen;
+        SeqLock<GazeData>       m_gaze_data;
+        GazeHistory             m_gaze_history;
+        std::vector<GazeData>   m_gaze_batch;
+        SharedSnapshot<CalibResult> m_calib_result;
+        SeqLock<Screen>         m_screen;
+        GazeFilter              m_gaze_filter;          // Guarded by m_filter_lock
+        boost::mutex            m_filter_lock;
+        boost::atomic<bool>     m_filtering;            // A filter other than GAF_NONE is set
+        GazeEventDetector       m_event_detector;       // Guarded by m_event_lock
+        boost::mutex            m_event_lock;
         std::map<int, Message>  m_sync_requests;
+        std::map<int, IRequestHandler *> m_async_requests;
+        ChangeFetch             m_change_fetches[ CK_COUNT ];   // Guarded by m_sync_lock
+        boost::atomic<int>      m_request_id;
 
-        mutable boost::mutex    m_calib_lock;
-        mutable boost::mutex    m_gaze_lock;
-        mutable boost::mutex    m_screen_lock;
         mutable boost::mutex    m_sync_lock;
+        boost::mutex            m_version_lock;
+        boost::condition_variable m_version_received;
+
+        boost::mutex            m_executor_lock;
+        std::vector<boost::shared_ptr<ListenerExecutor> > m_executors;
+        boost::asio::io_service * m_shared_pool;        // The GazeRuntime's dispatch threads, if any
+        boost::scoped_ptr<ThreadPool> m_listener_pool;
     };
 
-    GazeApi::GazeApi( int verbose_level )
-        : m_engine( new Engine( verbose_level ) )
+    GazeApi::GazeApi( int verbose_level, GazeApiThreadingMode threading )
+        : m_engine( new Engine( verbose_level, threading ) )
+    {
+    }
+
+    GazeApi::GazeApi( GazeRuntime & runtime, int verbose_level )
+        : m_engine( new Engine( *runtime.m_impl, verbose_level ) )
     {
     }
 
@@ -701,24 +1288,54 @@ namespace gtl
 
     void GazeApi::add_listener( IGazeListener & listener )
     {
-        m_engine->add_observer( listener );
+        m_engine->add_listener( listener, GALE_INLINE, 0 );
+    }
+
+    void GazeApi::add_listener( IGazeListener & listener, GazeApiListenerExecution execution, std::size_t queue_capacity )
+    {
+        m_engine->add_listener( listener, execution, queue_capacity );
     }
 
     void GazeApi::remove_listener( IGazeListener & listener )
+    {
+        m_engine->remove_listener( listener );
+    }
+
+    void GazeApi::add_listener( IGazeBatchListener & listener )
+    {
+        m_engine->add_observer( listener );
+    }
+
+    void GazeApi::remove_listener( IGazeBatchListener & listener )
     {
         m_engine->remove_observer( listener );
     }
 
-    void GazeApi::add_listener( ICalibrationResultListener & listener )
+    void GazeApi::add_listener( IGazeEventListener & listener )
     {
         m_engine->add_observer( listener );
     }
 
-    void GazeApi::remove_listener( ICalibrationResultListener & listener )
+    void GazeApi::remove_listener( IGazeEventListener & listener )
     {
         m_engine->remove_observer( listener );
     }
 
+    void GazeApi::add_listener( ICalibrationResultListener & listener )
+    {
+        m_engine->add_listener( listener, GALE_INLINE, 0 );
+    }
+
+    void GazeApi::add_listener( ICalibrationResultListener & listener, GazeApiListenerExecution execution, std::size_t queue_capacity )
+    {
+        m_engine->add_listener( listener, execution, queue_capacity );
+    }
+
+    void GazeApi::remove_listener( ICalibrationResultListener & listener )
+    {
+        m_engine->remove_listener( listener );
+    }
+
     void GazeApi::add_listener( IConnectionStateListener & listener )
     {
         m_engine->add_observer( listener );
@@ -731,12 +1348,17 @@ namespace gtl
 
     void GazeApi::add_listener( ITrackerStateListener & listener )
     {
-        m_engine->add_observer( listener );
+        m_engine->add_listener( listener, GALE_INLINE, 0 );
+    }
+
+    void GazeApi::add_listener( ITrackerStateListener & listener, GazeApiListenerExecution execution, std::size_t queue_capacity )
+    {
+        m_engine->add_listener( listener, execution, queue_capacity );
     }
 
     void GazeApi::remove_listener( ITrackerStateListener & listener )
     {
-        m_engine->remove_observer( listener );
+        m_engine->remove_listener( listener );
     }
 
     void GazeApi::add_listener( ICalibrationProcessHandler & listener )
@@ -778,6 +1400,46 @@ namespace gtl
         m_engine->disconnect();
     }
 
+    void GazeApi::set_frame_delivery( GazeApiFrameDelivery delivery )
+    {
+        m_engine->set_frame_delivery( delivery );
+    }
+
+    void GazeApi::set_filter( GazeApiFilterOptions const & options )
+    {
+        m_engine->set_filter( options );
+    }
+
+    void GazeApi::set_event_options( GazeApiEventOptions const & options )
+    {
+        m_engine->set_event_options( options );
+    }
+
+    bool GazeApi::set_thread_options( GazeApiThreadRole role, GazeApiThreadOptions const & options )
+    {
+        return m_engine->set_thread_options( role, options );
+    }
+
+    std::size_t GazeApi::poll()
+    {
+        return m_engine->poll();
+    }
+
+    std::size_t GazeApi::run_for( unsigned int timeout_ms )
+    {
+        return m_engine->run_for( timeout_ms );
+    }
+
+    GazeApiNativeHandle GazeApi::native_handle() const
+    {
+        return m_engine->native_handle();
+    }
+
+    std::size_t GazeApi::process_readable()
+    {
+        return m_engine->poll();
+    }
+
     bool GazeApi::set_screen( Screen const & screen )
     {
         return m_engine->set_screen( screen );
@@ -793,6 +1455,16 @@ namespace gtl
         m_engine->get_frame( gaze_data );
     }
 
+    std::size_t GazeApi::get_last_frames( std::size_t count, std::vector<GazeData> & frames ) const
+    {
+        return m_engine->get_last_frames( count, frames );
+    }
+
+    std::size_t GazeApi::get_frames_since( int time, std::vector<GazeData> & frames ) const
+    {
+        return m_engine->get_frames_since( time, frames );
+    }
+
     void GazeApi::get_calib_result( CalibResult & calib_result ) const
     {
         m_engine->get_calib_result( calib_result );
@@ -833,4 +1505,24 @@ namespace gtl
         m_engine->calibration_point_end();
     }
 
+    int GazeApi::set_screen_async( Screen const & screen, IRequestHandler * handler, unsigned int timeout_ms )
+    {
+        return m_engine->set_screen_async( screen, handler, timeout_ms );
+    }
+
+    int GazeApi::update_server_state_async( IRequestHandler * handler, unsigned int timeout_ms )
+    {
+        return m_engine->update_server_state_async( handler, timeout_ms );
+    }
+
+    int GazeApi::calibration_start_async( int const point_count, IRequestHandler * handler, unsigned int timeout_ms )
+    {
+        return m_engine->calibration_start_async( point_count, handler, timeout_ms );
+    }
+
+    int GazeApi::calibration_point_start_async( int const x, int const y, IRequestHandler * handler, unsigned int timeout_ms )
+    {
+        return m_engine->calibration_point_start_async( x, y, handler, timeout_ms );
+    }
+
 } // namespace gtl
\ No newline at end of file
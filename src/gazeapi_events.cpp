@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#include "gazeapi_events.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring> // memset
+
+
+namespace gtl
+{
+    namespace
+    {
+        double const DEGREES_PER_RADIAN = 57.29577951308232;
+
+        // Milliseconds from 'from' to 'to', allowing the timestamps to wrap
+        int elapsed( int const from, int const to )
+        {
+            return static_cast<int>( static_cast<unsigned int>( to ) - static_cast<unsigned int>( from ) );
+        }
+    }
+
+    void GazeEventDetector::FixationTrack::begin( Sample const & sample )
+    {
+        first = sample;
+        last = sample;
+        sum_x = sample.position.x;
+        sum_y = sample.position.y;
+        min_ax = max_ax = sample.ax;
+        min_ay = max_ay = sample.ay;
+        count = 1;
+    }
+
+    void GazeEventDetector::FixationTrack::add( Sample const & sample )
+    {
+        last = sample;
+        sum_x += sample.position.x;
+        sum_y += sample.position.y;
+        min_ax = std::min( min_ax, sample.ax );
+        max_ax = std::max( max_ax, sample.ax );
+        min_ay = std::min( min_ay, sample.ay );
+        max_ay = std::max( max_ay, sample.ay );
+        ++count;
+    }
+
+    double GazeEventDetector::FixationTrack::dispersion_with( Sample const & sample ) const
+    {
+        return std::max( max_ax, sample.ax ) - std::min( min_ax, sample.ax ) +
+            std::max( max_ay, sample.ay ) - std::min( min_ay, sample.ay );
+    }
+
+    Fixation GazeEventDetector::FixationTrack::fixation() const
+    {
+        Fixation fixation;
+        fixation.start = first.time;
+        fixation.duration = elapsed( first.time, last.time );
+        fixation.centroid.x = static_cast<float>( sum_x / count );
+        fixation.centroid.y = static_cast<float>( sum_y / count );
+        fixation.dispersion = static_cast<float>( max_ax - min_ax + max_ay - min_ay );
+        return fixation;
+    }
+
+    GazeEventDetector::GazeEventDetector()
+        : m_has_geometry( false )
+        , m_meters_per_pixel_x( 0.0 )
+        , m_meters_per_pixel_y( 0.0 )
+        , m_window_sequence( 0 )
+    {
+        memset( &m_screen, 0, sizeof( Screen ) );
+        reset();
+    }
+
+    void GazeEventDetector::set_options( GazeApiEventOptions const & options )
+    {
+        m_options = options;
+        set_screen( m_screen );
+        reset();
+    }
+
+    void GazeEventDetector::reset()
+    {
+        m_has_previous = false;
+        m_in_fixation = false;
+        m_fixation_reported = false;
+        m_in_saccade = false;
+        m_peak_velocity = 0.0;
+        clear_window();
+    }
+
+    std::size_t GazeEventDetector::process( GazeData const & gaze_data, Screen const & screen, GazeEvent * events )
+    {
+        std::size_t count = 0;
+
+        if( screen != m_screen )
+        {
+            end_all( events, count );
+            set_screen( screen );
+        }
+
+        Sample sample;
+        if( !make_sample( gaze_data, sample ) )
+        {
+            end_all( events, count );
+            return count;
+        }
+
+        if( m_has_previous )
+        {
+            int const interval = elapsed( m_previous.time, sample.time );
+
+            if( interval <= 0 )
+            {
+                return count; // A repeated or late frame
+            }
+
+            if( interval > MAX_FRAME_INTERVAL_MS )
+            {
+                end_all( events, count );
+            }
+            else
+            {
+                sample.velocity = angle( m_previous, sample ) * 1000.0 / interval;
+            }
+        }
+
+        if( m_options.detector == GAED_IDT )
+        {
+            process_idt( sample, events, count );
+        }
+        else
+        {
+            process_ivt( sample, events, count );
+        }
+
+        m_previous = sample;
+        m_has_previous = true;
+        return count;
+    }
+
+    void GazeEventDetector::set_screen( Screen const & screen )
+    {
+        m_screen = screen;
+        m_has_geometry = screen.screenresw > 0 && screen.screenresh > 0 &&
+            screen.screenpsyw > 0.0f && screen.screenpsyh > 0.0f && m_options.viewing_distance > 0.0f;
+
+        if( m_has_geometry )
+        {
+            m_meters_per_pixel_x = static_cast<double>( screen.screenpsyw ) / screen.screenresw;
+            m_meters_per_pixel_y = static_cast<double>( screen.screenpsyh ) / screen.screenresh;
+        }
+    }
+
+    // Ends everything in progress, reporting the end of a reported fixation
+    void GazeEventDetector::end_all( GazeEvent * events, std::size_t & count )
+    {
+        if( m_in_fixation && m_fixation_reported )
+        {
+            GazeEvent & event = events[ count++ ];
+            event.kind = GazeEvent::FIXATION_END;
+            event.fixation = m_fixation.fixation();
+        }
+        reset();
+    }
+
+    bool GazeEventDetector::make_sample( GazeData const & gaze_data, Sample & sample ) const
+    {
+        if( !m_has_geometry || ( gaze_data.state & GazeData::GD_STATE_TRACKING_GAZE ) == 0 )
+        {
+            return false;
+        }
+
+        double const distance = m_options.viewing_distance;
+        double const x = ( gaze_data.raw.x - 0.5 * m_screen.screenresw ) * m_meters_per_pixel_x;
+        double const y = ( gaze_data.raw.y - 0.5 * m_screen.screenresh ) * m_meters_per_pixel_y;
+
+        sample.time = gaze_data.time;
+        sample.position = gaze_data.raw;
+        sample.ax = std::atan2( x, distance ) * DEGREES_PER_RADIAN;
+        sample.ay = std::atan2( y, distance ) * DEGREES_PER_RADIAN;
+        sample.gaze[0] = x;
+        sample.gaze[1] = y;
+        sample.gaze[2] = distance;
+        sample.velocity = 0.0;
+        return true;
+    }
+
+    // A fixation is a run of intervals slower than the threshold, from the start of the first to the end of the last
+    void GazeEventDetector::process_ivt( Sample const & sample, GazeEvent * events, std::size_t & count )
+    {
+        if( !m_has_previous )
+        {
+            return;
+        }
+
+        if( sample.velocity < m_options.velocity_threshold )
+        {
+            if( !m_in_fixation )
+            {
+                m_fixation.begin( m_previous );
+                m_in_fixation = true;
+                m_fixation_reported = false;
+            }
+
+            m_fixation.add( sample );
+
+            if( !m_fixation_reported && elapsed( m_fixation.first.time, m_fixation.last.time ) >= m_options.min_fixation_duration )
+            {
+                start_fixation( events, count );
+            }
+            return;
+        }
+
+        if( m_in_fixation )
+        {
+            if( m_fixation_reported )
+            {
+                end_fixation( events, count );
+            }
+            else
+            {
+                m_in_fixation = false; // Too short; part of the saccade, if any
+            }
+        }
+
+        if( m_in_saccade )
+        {
+            m_peak_velocity = std::max( m_peak_velocity, sample.velocity );
+        }
+    }
+
+    // A fixation is a window of at least the minimum duration within the dispersion threshold, extended for as
+    // long as the samples stay within it
+    void GazeEventDetector::process_idt( Sample const & sample, GazeEvent * events, std::size_t & count )
+    {
+        if( m_in_fixation )
+        {
+            if( m_fixation.dispersion_with( sample ) <= m_options.dispersion_threshold )
+            {
+                m_fixation.add( sample );
+                return;
+            }
+
+            end_fixation( events, count );
+        }
+
+        push_window( sample );
+
+        while( !m_window.empty() && elapsed( m_window.front().time, m_window.back().time ) >= m_options.min_fixation_duration )
+        {
+            if( window_dispersion() <= m_options.dispersion_threshold )
+            {
+                m_fixation.first = m_window.front();
+                m_fixation.last = m_window.back();
+                m_fixation.sum_x = m_window_sum_x;
+                m_fixation.sum_y = m_window_sum_y;
+                m_fixation.min_ax = m_window_min_x.min();
+                m_fixation.max_ax = -m_window_max_x.min();
+                m_fixation.min_ay = m_window_min_y.min();
+                m_fixation.max_ay = -m_window_max_y.min();
+                m_fixation.count = m_window.size();
+
+                // The interval leading to the fixation is the last one of the saccade
+                if( m_in_saccade )
+                {
+                    m_peak_velocity = std::max( m_peak_velocity, m_window.front().velocity );
+                }
+
+                clear_window();
+                m_in_fixation = true;
+                start_fixation( events, count );
+                return;
+            }
+
+            pop_window();
+        }
+    }
+
+    void GazeEventDetector::start_fixation( GazeEvent * events, std::size_t & count )
+    {
+        if( m_in_saccade )
+        {
+            GazeEvent & event = events[ count++ ];
+            event.kind = GazeEvent::SACCADE;
+            event.saccade.start = m_saccade_origin.time;
+            event.saccade.duration = elapsed( m_saccade_origin.time, m_fixation.first.time );
+            event.saccade.from = m_saccade_origin.position;
+            event.saccade.to = m_fixation.first.position;
+            event.saccade.amplitude = static_cast<float>( angle( m_saccade_origin, m_fixation.first ) );
+            event.saccade.peak_velocity = static_cast<float>( m_peak_velocity );
+            m_in_saccade = false;
+        }
+
+        GazeEvent & event = events[ count++ ];
+        event.kind = GazeEvent::FIXATION_START;
+        event.fixation = m_fixation.fixation();
+        m_fixation_reported = true;
+    }
+
+    void GazeEventDetector::end_fixation( GazeEvent * events, std::size_t & count )
+    {
+        GazeEvent & event = events[ count++ ];
+        event.kind = GazeEvent::FIXATION_END;
+        event.fixation = m_fixation.fixation();
+
+        m_in_fixation = false;
+        m_fixation_reported = false;
+        m_in_saccade = true;
+        m_saccade_origin = m_fixation.last;
+        m_peak_velocity = 0.0;
+    }
+
+    void GazeEventDetector::push_window( Sample const & sample )
+    {
+        std::size_t const sequence = m_window_sequence++;
+
+        m_window.push_back( sample );
+        m_window_min_x.push( sequence, sample.ax );
+        m_window_max_x.push( sequence, -sample.ax );
+        m_window_min_y.push( sequence, sample.ay );
+        m_window_max_y.push( sequence, -sample.ay );
+        m_window_sum_x += sample.position.x;
+        m_window_sum_y += sample.position.y;
+    }
+
+    void GazeEventDetector::pop_window()
+    {
+        std::size_t const sequence = m_window_sequence - m_window.size();
+        Sample const & sample = m_window.front();
+
+        // Samples leaving the window without becoming part of a fixation belong to the saccade
+        if( m_in_saccade )
+        {
+            m_peak_velocity = std::max( m_peak_velocity, sample.velocity );
+        }
+
+        m_window_min_x.pop_until( sequence );
+        m_window_max_x.pop_until( sequence );
+        m_window_min_y.pop_until( sequence );
+        m_window_max_y.pop_until( sequence );
+        m_window_sum_x -= sample.position.x;
+        m_window_sum_y -= sample.position.y;
+        m_window.pop_front();
+    }
+
+    void GazeEventDetector::clear_window()
+    {
+        m_window.clear();
+        m_window_min_x.clear();
+        m_window_max_x.clear();
+        m_window_min_y.clear();
+        m_window_max_y.clear();
+        m_window_sum_x = 0.0;
+        m_window_sum_y = 0.0;
+    }
+
+    double GazeEventDetector::window_dispersion() const
+    {
+        return -m_window_max_x.min() - m_window_min_x.min() - m_window_max_y.min() - m_window_min_y.min();
+    }
+
+    // Angle between the gaze directions of two samples, in degrees
+    double GazeEventDetector::angle( Sample const & from, Sample const & to )
+    {
+        double const * const a = from.gaze;
+        double const * const b = to.gaze;
+
+        double const cx = a[1] * b[2] - a[2] * b[1];
+        double const cy = a[2] * b[0] - a[0] * b[2];
+        double const cz = a[0] * b[1] - a[1] * b[0];
+        double const dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+
+        return std::atan2( std::sqrt( cx * cx + cy * cy + cz * cz ), dot ) * DEGREES_PER_RADIAN;
+    }
+}
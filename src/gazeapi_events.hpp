@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifndef _THEEYETRIBE_GAZEAPI_EVENTS_H_
+#define _THEEYETRIBE_GAZEAPI_EVENTS_H_
+
+#include <gazeapi_types.h>
+
+#include <vector>
+
+
+namespace gtl
+{
+    /** A fixation or saccade found by GazeEventDetector. */
+    struct GazeEvent
+    {
+        enum Kind
+        {
+            FIXATION_START,
+            FIXATION_END,
+            SACCADE
+        };
+
+        Kind        kind;
+        Fixation    fixation;   // FIXATION_START and FIXATION_END
+        Saccade     saccade;    // SACCADE
+    };
+
+    /** FIFO ring that grows by doubling; once large enough, pushing and popping never allocate. */
+    template <typename T>
+    class GrowingRing
+    {
+    public:
+        GrowingRing()
+            : m_items( 16 )
+            , m_head( 0 )
+            , m_size( 0 )
+        {}
+
+        std::size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+
+        T & front() { return m_items[ m_head ]; }
+        T const & front() const { return m_items[ m_head ]; }
+        T & back() { return m_items[ ( m_head + m_size - 1 ) & ( m_items.size() - 1 ) ]; }
+        T const & back() const { return m_items[ ( m_head + m_size - 1 ) & ( m_items.size() - 1 ) ]; }
+
+        void push_back( T const & item )
+        {
+            if( m_size == m_items.size() )
+            {
+                std::vector<T> items( 2 * m_items.size() );
+                for( std::size_t i = 0; i < m_size; ++i )
+                {
+                    items[ i ] = m_items[ ( m_head + i ) & ( m_items.size() - 1 ) ];
+                }
+                m_items.swap( items );
+                m_head = 0;
+            }
+
+            m_items[ ( m_head + m_size ) & ( m_items.size() - 1 ) ] = item;
+            ++m_size;
+        }
+
+        void pop_front()
+        {
+            m_head = ( m_head + 1 ) & ( m_items.size() - 1 );
+            --m_size;
+        }
+
+        void pop_back()
+        {
+            --m_size;
+        }
+
+        void clear()
+        {
+            m_head = 0;
+            m_size = 0;
+        }
+
+    private:
+        std::vector<T>  m_items;    // Size is a power of two
+        std::size_t     m_head;
+        std::size_t     m_size;
+    };
+
+    /** Minimum over a sliding window of values, in O(1) amortized time per value.
+     *
+     *  Values are pushed with increasing sequence numbers and leave the window in the same order. Only
+     *  values that can still become the minimum are kept, so they increase from front to back and the
+     *  minimum is always at the front. For a maximum, push negated values.
+     */
+    class MonotonicQueue
+    {
+    public:
+        void push( std::size_t const sequence, double const value )
+        {
+            while( !m_entries.empty() && m_entries.back().value >= value )
+            {
+                m_entries.pop_back();
+            }
+
+            Entry const entry = { sequence, value };
+            m_entries.push_back( entry );
+        }
+
+        // Removes the values pushed up to and including 'sequence'
+        void pop_until( std::size_t const sequence )
+        {
+            while( !m_entries.empty() && m_entries.front().sequence <= sequence )
+            {
+                m_entries.pop_front();
+            }
+        }
+
+        double min() const { return m_entries.front().value; }
+
+        void clear() { m_entries.clear(); }
+
+    private:
+        struct Entry
+        {
+            std::size_t sequence;
+            double      value;
+        };
+
+        GrowingRing<Entry>  m_entries;
+    };
+
+    /** Online fixation and saccade detection on the raw gaze coordinates of consecutive GazeData frames.
+     *
+     *  Each frame is converted to visual angles using the physical size of the Screen and the viewing
+     *  distance. With GAED_IVT, a fixation is a run of frames between which the gaze moves slower than the
+     *  velocity threshold. With GAED_IDT, it is a run of frames whose horizontal plus vertical extent stays
+     *  within the dispersion threshold; the candidate window is kept in monotonic queues, so its extent is
+     *  known in O(1) amortized time per frame. Fixations shorter than the minimum duration are not reported;
+     *  a saccade is reported between two reported fixations once the second one has started.
+     *
+     *  Frames without gaze, or following the previous frame after a gap, end the current fixation. The
+     *  detector is not thread-safe.
+     */
+    class GazeEventDetector
+    {
+    public:
+        // Most events a single frame can produce
+        enum { MAX_EVENTS = 4 };
+
+        GazeEventDetector();
+
+        // Discards any fixation or saccade in progress
+        void set_options( GazeApiEventOptions const & options );
+
+        // Discards any fixation or saccade in progress, e.g. when connecting again
+        void reset();
+
+        /** Feeds the next frame and stores the events it completes in 'events'.
+         *
+         * \returns the number of events stored, at most MAX_EVENTS.
+         */
+        std::size_t process( GazeData const & gaze_data, Screen const & screen, GazeEvent * events );
+
+    private:
+        // Frames further apart than this are not considered consecutive
+        enum { MAX_FRAME_INTERVAL_MS = 100 };
+
+        struct Sample
+        {
+            int         time;
+            Point2D     position;   // Pixels
+            double      ax;         // Visual angle from the screen center, degrees
+            double      ay;
+            double      gaze[ 3 ];  // Direction from the eyes, in meters
+            double      velocity;   // Degrees per second from the previous sample; 0 for the first one
+        };
+
+        // Samples of a fixation, reported or not yet
+        struct FixationTrack
+        {
+            void begin( Sample const & sample );
+            void add( Sample const & sample );
+            double dispersion_with( Sample const & sample ) const;
+            Fixation fixation() const;
+
+            Sample  first;
+            Sample  last;
+            double  sum_x;
+            double  sum_y;
+            double  min_ax;
+            double  max_ax;
+            double  min_ay;
+            double  max_ay;
+            std::size_t count;
+        };
+
+        void set_screen( Screen const & screen );
+        void end_all( GazeEvent * events, std::size_t & count );
+        bool make_sample( GazeData const & gaze_data, Sample & sample ) const;
+        void process_ivt( Sample const & sample, GazeEvent * events, std::size_t & count );
+        void process_idt( Sample const & sample, GazeEvent * events, std::size_t & count );
+        void start_fixation( GazeEvent * events, std::size_t & count );
+        void end_fixation( GazeEvent * events, std::size_t & count );
+        void push_window( Sample const & sample );
+        void pop_window();
+        void clear_window();
+        double window_dispersion() const;
+
+        static double angle( Sample const & from, Sample const & to );
+
+    private:
+        GazeApiEventOptions m_options;
+        Screen              m_screen;
+        bool                m_has_geometry;
+        double              m_meters_per_pixel_x;
+        double              m_meters_per_pixel_y;
+
+        bool                m_has_previous;
+        Sample              m_previous;
+
+        bool                m_in_fixation;          // m_fixation holds the current fixation or I-VT candidate
+        bool                m_fixation_reported;    // on_fixation_start has been sent for m_fixation
+        FixationTrack       m_fixation;
+
+        bool                m_in_saccade;           // A reported fixation has ended; m_saccade_origin is its last sample
+        Sample              m_saccade_origin;
+        double              m_peak_velocity;
+
+        // I-DT candidate window: samples with sequence numbers m_window_sequence - size() up to m_window_sequence - 1
+        GrowingRing<Sample> m_window;
+        std::size_t         m_window_sequence;
+        MonotonicQueue      m_window_min_x;
+        MonotonicQueue      m_window_max_x;         // Negated
+        MonotonicQueue      m_window_min_y;
+        MonotonicQueue      m_window_max_y;         // Negated
+        double              m_window_sum_x;
+        double              m_window_sum_y;
+    };
+}
+
+#endif // _THEEYETRIBE_GAZEAPI_EVENTS_H_
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#include "gazeapi_executor.hpp"
+#include "gazeapi_observable.hpp"
+
+#include <algorithm>
+
+
+namespace gtl
+{
+    ListenerExecutor::ListenerExecutor( IGazeListener & listener, boost::asio::io_service * pool, std::size_t capacity )
+        : m_gaze_listener( &listener )
+        , m_calibration_listener( 0 )
+        , m_tracker_listener( 0 )
+    {
+        init( pool, capacity );
+    }
+
+    ListenerExecutor::ListenerExecutor( ICalibrationResultListener & listener, boost::asio::io_service * pool, std::size_t capacity )
+        : m_gaze_listener( 0 )
+        , m_calibration_listener( &listener )
+        , m_tracker_listener( 0 )
+    {
+        init( pool, capacity );
+    }
+
+    ListenerExecutor::ListenerExecutor( ITrackerStateListener & listener, boost::asio::io_service * pool, std::size_t capacity )
+        : m_gaze_listener( 0 )
+        , m_calibration_listener( 0 )
+        , m_tracker_listener( &listener )
+    {
+        init( pool, capacity );
+    }
+
+    ListenerExecutor::~ListenerExecutor()
+    {
+        stop();
+    }
+
+    void ListenerExecutor::init( boost::asio::io_service * pool, std::size_t capacity )
+    {
+        m_pool = pool;
+        m_ring.resize( std::max( capacity, std::size_t( 1 ) ) );
+        m_head = 0;
+        m_size = 0;
+        m_stopped = false;
+        m_scheduled = false;
+        m_calling = false;
+    }
+
+    void ListenerExecutor::start()
+    {
+        if( !m_pool )
+        {
+            // Like a pool task, the thread keeps the executor alive, even if its own listener removes it
+            m_thread = boost::thread( boost::bind( &ListenerExecutor::run, shared_from_this() ) );
+        }
+    }
+
+    void ListenerExecutor::stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock( m_lock );
+            m_stopped = true;
+            m_size = 0;
+            m_wakeup.notify_one();
+
+            while( m_calling && m_calling_thread != boost::this_thread::get_id() )
+            {
+                m_call_done.wait( lock );
+            }
+        }
+
+        if( m_thread.joinable() )
+        {
+            if( m_thread.get_id() == boost::this_thread::get_id() )
+            {
+                m_thread.detach(); // Removed by its own listener; the thread returns once the call does
+            }
+            else
+            {
+                m_thread.join();
+            }
+        }
+    }
+
+    void ListenerExecutor::on_gaze_data( GazeData const & gaze_data )
+    {
+        ListenerCall call;
+        call.kind = ListenerCall::GAZE_DATA;
+        call.gaze_data = gaze_data;
+        push( call );
+    }
+
+    void ListenerExecutor::on_calibration_changed( bool is_calibrated, CalibResult const & calib_result )
+    {
+        ListenerCall call;
+        call.kind = ListenerCall::CALIBRATION_CHANGED;
+        call.is_calibrated = is_calibrated;
+        call.calib_result.reset( new CalibResult( calib_result ) );
+        push( call );
+    }
+
+    void ListenerExecutor::on_tracker_connection_changed( int tracker_state )
+    {
+        ListenerCall call;
+        call.kind = ListenerCall::TRACKER_CONNECTION_CHANGED;
+        call.tracker_state = tracker_state;
+        push( call );
+    }
+
+    void ListenerExecutor::on_screen_state_changed( Screen const & screen )
+    {
+        ListenerCall call;
+        call.kind = ListenerCall::SCREEN_STATE_CHANGED;
+        call.screen = screen;
+        push( call );
+    }
+
+    void ListenerExecutor::push( ListenerCall & call )
+    {
+        bool post = false;
+        {
+            boost::lock_guard<boost::mutex> lock( m_lock );
+            if( m_stopped )
+            {
+                return; // Removed, but still reached by a notification that began before
+            }
+
+            if( m_size == m_ring.size() )
+            {
+                // The listener is too far behind, so give up its oldest call rather than wait for it
+                m_head = ( m_head + 1 ) % m_ring.size();
+                --m_size;
+            }
+
+            ListenerCall & slot = m_ring[ ( m_head + m_size ) % m_ring.size() ];
+            slot.kind = call.kind;
+            slot.gaze_data = call.gaze_data;
+            slot.calib_result.swap( call.calib_result );
+            slot.is_calibrated = call.is_calibrated;
+            slot.tracker_state = call.tracker_state;
+            slot.screen = call.screen;
+            ++m_size;
+
+            if( m_pool && !m_scheduled )
+            {
+                m_scheduled = true;
+                post = true;
+            }
+        }
+
+        if( post )
+        {
+            // The task keeps the executor alive, even if it is removed before the task runs
+            m_pool->post( boost::bind( &ListenerExecutor::drain, shared_from_this() ) );
+        }
+        else if( !m_pool )
+        {
+            m_wakeup.notify_one();
+        }
+    }
+
+    // Must be called with m_lock held
+    bool ListenerExecutor::begin_call( ListenerCall & call )
+    {
+        if( m_stopped || m_size == 0 )
+        {
+            return false;
+        }
+
+        ListenerCall & slot = m_ring[ m_head ];
+        call.kind = slot.kind;
+        call.gaze_data = slot.gaze_data;
+        call.calib_result = slot.calib_result;
+        slot.calib_result.reset();
+        call.is_calibrated = slot.is_calibrated;
+        call.tracker_state = slot.tracker_state;
+        call.screen = slot.screen;
+
+        m_head = ( m_head + 1 ) % m_ring.size();
+        --m_size;
+
+        m_calling = true;
+        m_calling_thread = boost::this_thread::get_id();
+        return true;
+    }
+
+    void ListenerExecutor::end_call()
+    {
+        boost::lock_guard<boost::mutex> lock( m_lock );
+        m_calling = false;
+        m_call_done.notify_all();
+    }
+
+    void ListenerExecutor::invoke( ListenerCall const & call )
+    {
+        // A listener removing another one must not wait for notifications, which may be waiting for this call
+        NotificationScope const scope;
+
+        switch( call.kind )
+        {
+        case ListenerCall::GAZE_DATA:
+            m_gaze_listener->on_gaze_data( call.gaze_data );
+            break;
+
+        case ListenerCall::CALIBRATION_CHANGED:
+            m_calibration_listener->on_calibration_changed( call.is_calibrated, *call.calib_result );
+            break;
+
+        case ListenerCall::TRACKER_CONNECTION_CHANGED:
+            m_tracker_listener->on_tracker_connection_changed( call.tracker_state );
+            break;
+
+        case ListenerCall::SCREEN_STATE_CHANGED:
+            m_tracker_listener->on_screen_state_changed( call.screen );
+            break;
+        }
+    }
+
+    void ListenerExecutor::run()
+    {
+        ListenerCall call;
+
+        for( ;; )
+        {
+            {
+                boost::unique_lock<boost::mutex> lock( m_lock );
+                while( !m_stopped && m_size == 0 )
+                {
+                    m_wakeup.wait( lock );
+                }
+
+                if( !begin_call( call ) )
+                {
+                    return; // Stopped
+                }
+            }
+
+            invoke( call );
+            end_call();
+        }
+    }
+
+    void ListenerExecutor::drain()
+    {
+        ListenerCall call;
+        boost::chrono::steady_clock::time_point const deadline = boost::chrono::steady_clock::now() + boost::chrono::microseconds( DRAIN_BUDGET_US );
+
+        for( int count = 0; count < DRAIN_BATCH && boost::chrono::steady_clock::now() < deadline; ++count )
+        {
+            {
+                boost::lock_guard<boost::mutex> lock( m_lock );
+                if( !begin_call( call ) )
+                {
+                    m_scheduled = false;
+                    return;
+                }
+            }
+
+            invoke( call );
+            end_call();
+        }
+
+        // Possibly more to do, but let other work queued on the pool go first
+        m_pool->post( boost::bind( &ListenerExecutor::drain, shared_from_this() ) );
+    }
+}
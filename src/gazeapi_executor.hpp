@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifndef _THEEYETRIBE_GAZEAPI_EXECUTOR_H_
+#define _THEEYETRIBE_GAZEAPI_EXECUTOR_H_
+
+#include <gazeapi_interfaces.h>
+#include <gazeapi_types.h>
+
+#include <boost/asio.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+
+namespace gtl
+{
+    /** A pending call to a listener. Frames are carried as parsed GazeData, so no message text is copied. */
+    struct ListenerCall
+    {
+        enum Kind
+        {
+            GAZE_DATA,
+            CALIBRATION_CHANGED,
+            TRACKER_CONNECTION_CHANGED,
+            SCREEN_STATE_CHANGED
+        };
+
+        Kind                                kind;
+        GazeData                            gaze_data;
+        boost::shared_ptr<CalibResult const> calib_result;
+        bool                                is_calibrated;
+        int                                 tracker_state;
+        Screen                              screen;
+    };
+
+    /** Stands in for a listener registered with GALE_WORKER or GALE_POOL.
+     *
+     *  The executor is added to the Engine's observers in place of the listener. Each notification is
+     *  queued and the listener is called later, one call at a time and in order, either by a thread of
+     *  the executor's own or by whichever thread of 'pool' drains the queue. The queue is a ring of fixed
+     *  capacity: when the listener falls that far behind, its oldest pending call is dropped, so the
+     *  thread notifying the executor never waits for the listener.
+     */
+    class ListenerExecutor
+        : public IGazeListener
+        , public ICalibrationResultListener
+        , public ITrackerStateListener
+        , public boost::enable_shared_from_this<ListenerExecutor>
+    {
+    public:
+        /** \param[in] pool io_service to drain the queue on, or 0 for a thread of its own. */
+        ListenerExecutor( IGazeListener & listener, boost::asio::io_service * pool, std::size_t capacity );
+        ListenerExecutor( ICalibrationResultListener & listener, boost::asio::io_service * pool, std::size_t capacity );
+        ListenerExecutor( ITrackerStateListener & listener, boost::asio::io_service * pool, std::size_t capacity );
+        ~ListenerExecutor();
+
+        /** Start the thread of its own, unless it runs on a pool. Called once a shared_ptr owns the executor. */
+        void start();
+
+        bool calls( IGazeListener const & listener ) const { return m_gaze_listener == &listener; }
+        bool calls( ICalibrationResultListener const & listener ) const { return m_calibration_listener == &listener; }
+        bool calls( ITrackerStateListener const & listener ) const { return m_tracker_listener == &listener; }
+
+        /** Drop all pending calls and wait for a call in progress to return, unless the caller is that call.
+         *  The listener is not called anymore afterwards.
+         */
+        void stop();
+
+        // Notifications, queued for the listener
+        void on_gaze_data( GazeData const & gaze_data );
+        void on_calibration_changed( bool is_calibrated, CalibResult const & calib_result );
+        void on_tracker_connection_changed( int tracker_state );
+        void on_screen_state_changed( Screen const & screen );
+
+    private:
+        // A pool task lets other pool work go first after this many calls, or once it has run this long
+        enum { DRAIN_BATCH = 64, DRAIN_BUDGET_US = 1000 };
+
+        void init( boost::asio::io_service * pool, std::size_t capacity );
+        void push( ListenerCall & call );
+        bool begin_call( ListenerCall & call );
+        void end_call();
+        void invoke( ListenerCall const & call );
+        void run();
+        void drain();
+
+    private:
+        IGazeListener *                 m_gaze_listener;
+        ICalibrationResultListener *    m_calibration_listener;
+        ITrackerStateListener *         m_tracker_listener;
+        boost::asio::io_service *       m_pool;
+        std::vector<ListenerCall>       m_ring;
+        std::size_t                     m_head;
+        std::size_t                     m_size;
+        bool                            m_stopped;
+        bool                            m_scheduled;        // Pool only: a drain task is posted or running
+        bool                            m_calling;          // The listener is being called right now
+        boost::thread::id               m_calling_thread;
+        boost::mutex                    m_lock;
+        boost::condition_variable       m_wakeup;
+        boost::condition_variable       m_call_done;
+        boost::thread                   m_thread;
+    };
+}
+
+#endif // _THEEYETRIBE_GAZEAPI_EXECUTOR_H_
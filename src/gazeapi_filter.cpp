@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#include "gazeapi_filter.hpp"
+
+#include <cmath>
+
+
+namespace gtl
+{
+    namespace
+    {
+        double const TWO_PI = 6.283185307179586;
+
+        // Variance of the velocity when a point starts, in pixels^2 per second^2
+        double const INITIAL_VELOCITY_VARIANCE = 1.0e6;
+
+        // Milliseconds from 'from' to 'to', allowing the timestamps to wrap
+        int elapsed( int const from, int const to )
+        {
+            return static_cast<int>( static_cast<unsigned int>( to ) - static_cast<unsigned int>( from ) );
+        }
+
+        // Weight of a new value in an exponential low-pass filter with the given cutoff frequency
+        double smoothing_factor( double const cutoff, double const dt )
+        {
+            double const r = TWO_PI * cutoff * dt;
+            return r / ( r + 1.0 );
+        }
+    }
+
+    GazeFilter::GazeFilter()
+    {
+        reset();
+    }
+
+    void GazeFilter::set_options( GazeApiFilterOptions const & options )
+    {
+        m_options = options;
+        reset();
+    }
+
+    void GazeFilter::reset()
+    {
+        for( int i = 0; i < POINT_COUNT; ++i )
+        {
+            m_points[i].active = false;
+        }
+    }
+
+    void GazeFilter::apply( GazeData & gaze_data )
+    {
+        if( m_options.filter == GAF_NONE )
+        {
+            return;
+        }
+
+        apply( m_points[0], gaze_data.time, gaze_data.raw );
+        apply( m_points[1], gaze_data.time, gaze_data.lefteye.raw );
+        apply( m_points[2], gaze_data.time, gaze_data.righteye.raw );
+    }
+
+    void GazeFilter::apply( PointState & state, int const time, Point2D & point )
+    {
+        if( point.x == 0.0f && point.y == 0.0f )
+        {
+            state.active = false;
+            return;
+        }
+
+        if( !state.active )
+        {
+            start( state, time, point );
+            return;
+        }
+
+        int const interval = elapsed( state.time, time );
+
+        if( interval <= 0 )
+        {
+            point.x = static_cast<float>( estimate( state, 0 ) );
+            point.y = static_cast<float>( estimate( state, 1 ) );
+            return;
+        }
+
+        if( interval > MAX_FRAME_INTERVAL_MS )
+        {
+            start( state, time, point );
+            return;
+        }
+
+        double const dt = interval / 1000.0;
+        state.time = time;
+
+        if( m_options.filter == GAF_KALMAN )
+        {
+            point.x = static_cast<float>( filter_kalman( state.kalman[0], point.x, dt ) );
+            point.y = static_cast<float>( filter_kalman( state.kalman[1], point.y, dt ) );
+        }
+        else
+        {
+            point.x = static_cast<float>( filter_one_euro( state.one_euro[0], point.x, dt ) );
+            point.y = static_cast<float>( filter_one_euro( state.one_euro[1], point.y, dt ) );
+        }
+    }
+
+    // The speed is estimated from the filtered values and smoothed itself; it raises the cutoff, so fast
+    // movements are followed with little lag while the gaze is smoothed strongly at rest
+    double GazeFilter::filter_one_euro( OneEuro & state, double const value, double const dt ) const
+    {
+        double const derivative = ( value - state.value ) / dt;
+        state.derivative += smoothing_factor( m_options.derivative_cutoff, dt ) * ( derivative - state.derivative );
+
+        double const cutoff = m_options.min_cutoff + m_options.beta * std::fabs( state.derivative );
+        state.value += smoothing_factor( cutoff, dt ) * ( value - state.value );
+        return state.value;
+    }
+
+    // Predicts position and velocity over 'dt' with white noise acceleration, then corrects them by the measurement
+    double GazeFilter::filter_kalman( Kalman & state, double const value, double const dt ) const
+    {
+        double const q = m_options.process_noise;
+        double const r = m_options.measurement_noise;
+
+        state.position += state.velocity * dt;
+        state.p00 += dt * ( 2.0 * state.p01 + dt * state.p11 ) + q * dt * dt * dt / 3.0;
+        state.p01 += dt * state.p11 + q * dt * dt / 2.0;
+        state.p11 += q * dt;
+
+        double const innovation = value - state.position;
+        double const variance = state.p00 + r;
+        double const k0 = state.p00 / variance;
+        double const k1 = state.p01 / variance;
+
+        state.position += k0 * innovation;
+        state.velocity += k1 * innovation;
+        state.p11 -= k1 * state.p01;
+        state.p01 -= k1 * state.p00;
+        state.p00 -= k0 * state.p00;
+        return state.position;
+    }
+
+    void GazeFilter::start( PointState & state, int const time, Point2D const & point ) const
+    {
+        double const coordinates[ 2 ] = { point.x, point.y };
+
+        state.active = true;
+        state.time = time;
+
+        for( int axis = 0; axis < 2; ++axis )
+        {
+            state.one_euro[axis].value = coordinates[axis];
+            state.one_euro[axis].derivative = 0.0;
+
+            state.kalman[axis].position = coordinates[axis];
+            state.kalman[axis].velocity = 0.0;
+            state.kalman[axis].p00 = m_options.measurement_noise;
+            state.kalman[axis].p01 = 0.0;
+            state.kalman[axis].p11 = INITIAL_VELOCITY_VARIANCE;
+        }
+    }
+
+    double GazeFilter::estimate( PointState const & state, int const axis ) const
+    {
+        return m_options.filter == GAF_KALMAN ? state.kalman[axis].position : state.one_euro[axis].value;
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifndef _THEEYETRIBE_GAZEAPI_FILTER_H_
+#define _THEEYETRIBE_GAZEAPI_FILTER_H_
+
+#include <gazeapi_types.h>
+
+
+namespace gtl
+{
+    /** Smooths the raw gaze coordinates of consecutive GazeData frames: raw, lefteye.raw and righteye.raw.
+     *
+     *  Each coordinate is filtered on its own, by a One Euro filter or by a Kalman filter with a constant
+     *  velocity model, using the frame timestamps for the time steps. The state is a fixed set of numbers
+     *  per coordinate, so filtering never allocates.
+     *
+     *  A point at (0, 0), which the server sends while it does not track, is passed on and restarts the
+     *  filtering of that point, as does a gap between frames. A frame not newer than the previous one
+     *  gets the current estimate. The filter is not thread-safe.
+     */
+    class GazeFilter
+    {
+    public:
+        GazeFilter();
+
+        // Restarts filtering
+        void set_options( GazeApiFilterOptions const & options );
+        GazeApiFilterOptions const & options() const { return m_options; }
+
+        // Restarts filtering, e.g. when connecting again
+        void reset();
+
+        // Replaces the raw coordinates of 'gaze_data' with filtered ones
+        void apply( GazeData & gaze_data );
+
+    private:
+        // Frames further apart than this restart filtering
+        enum { MAX_FRAME_INTERVAL_MS = 100 };
+
+        enum { POINT_COUNT = 3 };
+
+        struct OneEuro
+        {
+            double      value;
+            double      derivative;
+        };
+
+        struct Kalman
+        {
+            double      position;
+            double      velocity;
+            double      p00;        // Covariance of position and velocity
+            double      p01;
+            double      p11;
+        };
+
+        // Both coordinates of one point
+        struct PointState
+        {
+            bool        active;
+            int         time;
+            OneEuro     one_euro[ 2 ];
+            Kalman      kalman[ 2 ];
+        };
+
+        void apply( PointState & state, int time, Point2D & point );
+        double filter_one_euro( OneEuro & state, double value, double dt ) const;
+        double filter_kalman( Kalman & state, double value, double dt ) const;
+        void start( PointState & state, int time, Point2D const & point ) const;
+        double estimate( PointState const & state, int axis ) const;
+
+    private:
+        GazeApiFilterOptions    m_options;
+        PointState              m_points[ POINT_COUNT ];    // raw, lefteye.raw, righteye.raw
+    };
+}
+
+#endif // _THEEYETRIBE_GAZEAPI_FILTER_H_
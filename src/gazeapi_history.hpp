@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifndef _THEEYETRIBE_GAZEAPI_HISTORY_H_
+#define _THEEYETRIBE_GAZEAPI_HISTORY_H_
+
+#include <gazeapi_types.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+#include <cstring> // memcpy
+#include <vector>
+
+
+namespace gtl
+{
+    /** Fixed-capacity ring of the most recent GazeData frames.
+     *
+     *  Every slot carries its own sequence number, so readers can copy frames out while the writer keeps
+     *  appending: a slot that was overwritten during the copy is detected and ends the read. Readers never
+     *  block; writers are serialized among themselves.
+     */
+    class GazeHistory
+    {
+    public:
+        enum { CAPACITY = 512 }; // about 8.5 seconds at 60 Hz
+
+        GazeHistory()
+            : m_begin( 0 )
+            , m_next( 0 )
+        {
+            for( std::size_t i = 0; i < CAPACITY; ++i )
+            {
+                m_slots[ i ].sequence.store( 0, boost::memory_order_relaxed );
+            }
+        }
+
+        void push( GazeData const & gaze_data )
+        {
+            boost::lock_guard<boost::mutex> lock( m_write_lock );
+
+            std::size_t const index = m_next.load( boost::memory_order_relaxed );
+            Slot & slot = m_slots[ index & MASK ];
+
+            slot.sequence.store( 2 * index + 1, boost::memory_order_relaxed ); // odd: write in progress
+            boost::atomic_thread_fence( boost::memory_order_release );
+            memcpy( &slot.data, &gaze_data, sizeof( GazeData ) );
+            slot.sequence.store( 2 * index + 2, boost::memory_order_release );
+
+            m_next.store( index + 1, boost::memory_order_release );
+        }
+
+        // Forget all frames, e.g. when connecting again
+        void clear()
+        {
+            boost::lock_guard<boost::mutex> lock( m_write_lock );
+            m_begin.store( m_next.load( boost::memory_order_relaxed ), boost::memory_order_release );
+        }
+
+        // Copies up to 'count' of the latest frames into 'frames', oldest first
+        std::size_t copy_last( std::size_t const count, std::vector<GazeData> & frames ) const
+        {
+            std::size_t const next = m_next.load( boost::memory_order_acquire );
+            std::size_t const size = std::min( std::min( next - m_begin.load( boost::memory_order_acquire ), std::size_t( CAPACITY ) ), count );
+
+            frames.resize( size );
+
+            std::size_t copied = 0;
+            while( copied < size && read( next - 1 - copied, frames[ size - 1 - copied ] ) )
+            {
+                ++copied;
+            }
+
+            // Frames overwritten while copying are dropped from the front
+            frames.erase( frames.begin(), frames.begin() + ( size - copied ) );
+            return copied;
+        }
+
+        // Copies all frames with a timestamp at or after 'time' into 'frames', oldest first
+        std::size_t copy_since( int const time, std::vector<GazeData> & frames ) const
+        {
+            std::size_t const next = m_next.load( boost::memory_order_acquire );
+            std::size_t const size = std::min( next - m_begin.load( boost::memory_order_acquire ), std::size_t( CAPACITY ) );
+
+            frames.clear();
+
+            GazeData gaze_data;
+            for( std::size_t i = 0; i < size && read( next - 1 - i, gaze_data ); ++i )
+            {
+                // Compare through the difference so that timestamps may wrap
+                if( static_cast<int>( static_cast<unsigned int>( gaze_data.time ) - static_cast<unsigned int>( time ) ) < 0 )
+                {
+                    break;
+                }
+                frames.push_back( gaze_data );
+            }
+
+            std::reverse( frames.begin(), frames.end() );
+            return frames.size();
+        }
+
+    private:
+        bool read( std::size_t const index, GazeData & gaze_data ) const
+        {
+            Slot const & slot = m_slots[ index & MASK ];
+            std::size_t const sequence = slot.sequence.load( boost::memory_order_acquire );
+
+            if( sequence != 2 * index + 2 )
+            {
+                return false; // Overwritten by a newer frame, or being written right now
+            }
+
+            memcpy( &gaze_data, &slot.data, sizeof( GazeData ) );
+            boost::atomic_thread_fence( boost::memory_order_acquire );
+            return slot.sequence.load( boost::memory_order_relaxed ) == sequence;
+        }
+
+    private:
+        enum { MASK = CAPACITY - 1 };
+
+        struct Slot
+        {
+            boost::atomic<std::size_t>  sequence;
+            GazeData                    data;
+        };
+
+        Slot                        m_slots[ CAPACITY ];
+        boost::atomic<std::size_t>  m_begin;
+        boost::atomic<std::size_t>  m_next;
+        boost::mutex                m_write_lock;
+    };
+}
+
+#endif // _THEEYETRIBE_GAZEAPI_HISTORY_H_
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#include "gazeapi_observable.hpp"
+
+#include <boost/thread/tss.hpp>
+
+
+namespace gtl
+{
+    namespace
+    {
+        boost::thread_specific_ptr<int> g_notification_depth;
+    }
+
+    int & notification_depth()
+    {
+        int * depth = g_notification_depth.get();
+        if( !depth )
+        {
+            depth = new int( 0 );
+            g_notification_depth.reset( depth );
+        }
+        return *depth;
+    }
+}
@@ -10,62 +10,208 @@
 #ifndef _THEEYETRIBE_GAZEAPI_OBSERVABLE_H_
 #define _THEEYETRIBE_GAZEAPI_OBSERVABLE_H_
 
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
 #include <vector>
 
 
 namespace gtl
 {
+    /** How deeply the calling thread is nested in notifications, i.e. ObserverVectors and NotificationScopes it holds. */
+    int & notification_depth();
+
+    /** Marks the calling thread as notifying for its lifetime, e.g. while a listener is called from a queue. */
+    class NotificationScope
+    {
+    public:
+        NotificationScope() { ++notification_depth(); }
+        ~NotificationScope() { --notification_depth(); }
+
+    private:
+        NotificationScope( NotificationScope const & other );
+        NotificationScope & operator = ( NotificationScope const & other );
+    };
+
+    /** List of observers that may be changed from any thread while it is being notified.
+     *
+     *  The list is copy-on-write: adding or removing an observer publishes a new immutable list, and
+     *  notifying only takes a reference to the current one, so it never waits for a change in progress.
+     *
+     *  Once remove_observer() returns, no notification calls the observer anymore, so it may be deleted.
+     *  Only when called from within a notification, which would wait for itself, does it return at once:
+     *  a notification in progress on another thread may then still reach the observer.
+     *
+     *  An observer may be added together with an owner, which the lists that contain the observer keep
+     *  alive. It is released along with the last list a notification still holds.
+     */
     template <typename T>
     class Observable
     {
+        struct Entry
+        {
+            T *                         observer;
+            boost::shared_ptr<void>     owner;
+        };
+
+        typedef std::vector<Entry> List;
+
     public:
-        typedef std::vector<T*> ObserverVector;
+        /** The observers as of one moment, kept alive for as long as it is held. */
+        class ObserverVector
+        {
+        public:
+            ObserverVector( ObserverVector const & other )
+                : m_observers( other.m_observers )
+            {
+                ++notification_depth();
+            }
+
+            ~ObserverVector()
+            {
+                --notification_depth();
+            }
+
+            std::size_t size() const
+            {
+                return m_observers->size();
+            }
+
+            T * operator[]( std::size_t index ) const
+            {
+                return ( *m_observers )[ index ].observer;
+            }
+
+        private:
+            friend class Observable;
+
+            explicit ObserverVector( boost::shared_ptr<List const> const & observers )
+                : m_observers( observers )
+            {
+                ++notification_depth();
+            }
+
+            ObserverVector & operator = ( ObserverVector const & other );
+
+            boost::shared_ptr<List const> m_observers;
+        };
+
+        Observable()
+            : m_observers( new List() )
+        {}
 
         virtual ~Observable()
         {}
 
-        void add_observer( T & observer )
+        void add_observer( T & observer, boost::shared_ptr<void> const & owner = boost::shared_ptr<void>() )
         {
-            for( std::size_t i = 0; i < m_observers.size(); ++i )
+            boost::lock_guard<boost::mutex> lock( m_write_lock );
+            List const & current = *m_observers;
+
+            for( std::size_t i = 0; i < current.size(); ++i )
             {
-                if( &observer == m_observers[ i ] )
+                if( &observer == current[ i ].observer )
                 {
                     return; // Already added, just ignore
                 }
             }
 
-            m_observers.push_back( &observer );
+            Entry entry;
+            entry.observer = &observer;
+            entry.owner = owner;
+
+            boost::shared_ptr<List> const observers( new List( current ) );
+            observers->push_back( entry );
+            publish( observers );
         }
 
         void remove_observer( T & observer )
         {
-            for( int i = m_observers.size() - 1; i >= 0; --i )
+            std::vector<boost::weak_ptr<List const> > readers;
             {
-                if( &observer == m_observers[ i ] )
+                boost::lock_guard<boost::mutex> lock( m_write_lock );
+                boost::shared_ptr<List> const observers( new List( *m_observers ) );
+
+                for( int i = observers->size() - 1; i >= 0; --i )
                 {
-                    m_observers[ i ] = m_observers[ m_observers.size() - 1 ];
-                    m_observers.resize( m_observers.size() - 1 );
+                    if( &observer == ( *observers )[ i ].observer )
+                    {
+                        ( *observers )[ i ] = ( *observers )[ observers->size() - 1 ];
+                        observers->resize( observers->size() - 1 );
+                    }
                 }
+                publish( observers );
+                readers = m_retired;
             }
+
+            wait_for_readers( readers );
         }
 
-        ObserverVector const & get_observers() const
+        ObserverVector get_observers() const
         {
-            return m_observers;
+            return ObserverVector( boost::atomic_load( &m_observers ) );
         }
 
         std::size_t size() const
         {
-            return m_observers.size();
+            return boost::atomic_load( &m_observers )->size();
         }
 
         void clear()
         {
-            m_observers.clear();
+            std::vector<boost::weak_ptr<List const> > readers;
+            {
+                boost::lock_guard<boost::mutex> lock( m_write_lock );
+                publish( boost::shared_ptr<List>( new List() ) );
+                readers = m_retired;
+            }
+
+            wait_for_readers( readers );
+        }
+
+    private:
+        // Must be called with m_write_lock held, which also makes reading m_observers without atomic_load safe
+        void publish( boost::shared_ptr<List> const & observers )
+        {
+            // Remember the replaced list for as long as a notification holds it
+            for( std::size_t i = m_retired.size(); i > 0; --i )
+            {
+                if( m_retired[ i - 1 ].expired() )
+                {
+                    m_retired[ i - 1 ] = m_retired.back();
+                    m_retired.pop_back();
+                }
+            }
+            m_retired.push_back( m_observers );
+
+            boost::shared_ptr<List const> const snapshot( observers );
+            boost::atomic_store( &m_observers, snapshot );
+        }
+
+        // Grace period: notifications that began before a change hold one of the lists retired by then
+        static void wait_for_readers( std::vector<boost::weak_ptr<List const> > const & readers )
+        {
+            if( notification_depth() > 0 )
+            {
+                return; // A notification in progress on this thread could otherwise wait for itself
+            }
+
+            for( std::size_t i = 0; i < readers.size(); ++i )
+            {
+                while( !readers[ i ].expired() )
+                {
+                    boost::this_thread::yield();
+                }
+            }
         }
 
     private:
-        ObserverVector m_observers;
+        boost::shared_ptr<List const>               m_observers;
+        std::vector<boost::weak_ptr<List const> >   m_retired;      // Replaced lists, possibly still being notified
+        boost::mutex                                m_write_lock;
     };
 }
 
@@ -10,10 +10,469 @@
 #include "gazeapi_parser.hpp"
 
 #include <string>
+#include <cstring>
+#include <istream>
+#include <locale>
+#include <sstream>
+#include <streambuf>
 
 
+namespace
+{
+    // Read-only stream buffer over an existing range of bytes, so that the ptree parser can read a
+    // received message in place instead of from a copy in a stringstream
+    class RangeStreamBuf : public std::streambuf
+    {
+    public:
+        RangeStreamBuf( char const * begin, char const * end )
+        {
+            char * const first = const_cast<char *>( begin );
+            setg( first, first, first + ( end - begin ) );
+        }
+    };
+
+    // Cursor helpers for the schema specialized frame parser. They operate directly on the received
+    // bytes and never allocate.
+
+    inline void skip_ws( char const *& it, char const * end )
+    {
+        while( it != end && ( *it == ' ' || *it == '\t' || *it == '\r' || *it == '\n' ) )
+        {
+            ++it;
+        }
+    }
+
+    inline bool consume( char const *& it, char const * end, char const c )
+    {
+        skip_ws( it, end );
+
+        if( it == end || *it != c )
+        {
+            return false;
+        }
+
+        ++it;
+        return true;
+    }
+
+    template <size_t N>
+    inline bool equals( char const * str, size_t len, char const ( &literal )[ N ] )
+    {
+        return len == N - 1 && 0 == memcmp( str, literal, N - 1 );
+    }
+
+    // Reads a string token and returns its raw content (escape sequences are not decoded)
+    bool read_string( char const *& it, char const * end, char const *& str, size_t & len )
+    {
+        if( !consume( it, end, '"' ) )
+        {
+            return false;
+        }
+
+        char const * const begin = it;
+
+        while( it != end && *it != '"' )
+        {
+            if( *it == '\\' && ++it == end )
+            {
+                return false;
+            }
+            ++it;
+        }
+
+        if( it == end )
+        {
+            return false;
+        }
+
+        str = begin;
+        len = it - begin;
+        ++it; // closing quote
+        return true;
+    }
+
+    // Reads an object key and the following ':'
+    inline bool read_key( char const *& it, char const * end, char const *& key, size_t & len )
+    {
+        return read_string( it, end, key, len ) && consume( it, end, ':' );
+    }
+
+    bool read_int( char const *& it, char const * end, long long & value )
+    {
+        skip_ws( it, end );
+
+        bool const negative = it != end && *it == '-';
+        if( negative )
+        {
+            ++it;
+        }
+
+        char const * const begin = it;
+        long long result = 0;
+
+        while( it != end && *it >= '0' && *it <= '9' )
+        {
+            result = result * 10 + ( *it - '0' );
+            ++it;
+        }
+
+        value = negative ? -result : result;
+        return it != begin;
+    }
+
+    inline bool read_int( char const *& it, char const * end, int & value )
+    {
+        long long result;
+
+        if( !read_int( it, end, result ) )
+        {
+            return false;
+        }
+
+        value = static_cast<int>( result );
+        return true;
+    }
+
+    inline bool is_digit( char const c )
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // Powers of ten that are exactly representable as a double
+    double const EXACT_POWERS_OF_TEN[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    // Reads a JSON number, independent of the C and C++ locales.
+    //
+    // If the significant digits fit into 53 bits and the decimal exponent is at most 22 in magnitude, both
+    // are exact doubles and a single multiplication or division yields the correctly rounded result
+    // (Clinger's fast path). That covers everything the server sends; other numbers take a slow path
+    // through a classic-locale stream.
+    bool read_number( char const *& it, char const * end, double & value )
+    {
+        skip_ws( it, end );
+
+        char const * const begin = it;
+        bool const negative = it != end && *it == '-';
+        if( negative )
+        {
+            ++it;
+        }
+
+        unsigned long long mantissa = 0;
+        int digits = 0;         // significant digits in mantissa
+        int exponent = 0;       // decimal exponent to apply to mantissa
+        bool exact = true;      // false if digits had to be dropped from mantissa
+        char const * const integer_begin = it;
+
+        for( ; it != end && is_digit( *it ); ++it )
+        {
+            if( digits < 19 )
+            {
+                mantissa = mantissa * 10 + ( *it - '0' );
+                digits += mantissa != 0;
+            }
+            else
+            {
+                ++exponent;
+                exact = exact && *it == '0';
+            }
+        }
+
+        bool has_digits = it != integer_begin;
+
+        if( it != end && *it == '.' )
+        {
+            char const * const fraction_begin = ++it;
+
+            for( ; it != end && is_digit( *it ); ++it )
+            {
+                if( digits < 19 )
+                {
+                    mantissa = mantissa * 10 + ( *it - '0' );
+                    digits += mantissa != 0;
+                    --exponent;
+                }
+                else
+                {
+                    exact = exact && *it == '0';
+                }
+            }
+
+            has_digits = has_digits || it != fraction_begin;
+        }
+
+        if( !has_digits )
+        {
+            it = begin;
+            return false;
+        }
+
+        if( it != end && ( *it == 'e' || *it == 'E' ) )
+        {
+            ++it;
+
+            bool const negative_exponent = it != end && *it == '-';
+            if( it != end && ( *it == '-' || *it == '+' ) )
+            {
+                ++it;
+            }
+
+            char const * const exponent_begin = it;
+            int explicit_exponent = 0;
+
+            for( ; it != end && is_digit( *it ); ++it )
+            {
+                if( explicit_exponent < 100000 )
+                {
+                    explicit_exponent = explicit_exponent * 10 + ( *it - '0' );
+                }
+            }
+
+            if( it == exponent_begin )
+            {
+                it = begin;
+                return false;
+            }
+
+            exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+        }
+
+        if( exact && mantissa <= ( 1ULL << 53 ) && exponent >= -22 && exponent <= 22 )
+        {
+            double const result = exponent < 0 ?
+                static_cast<double>( mantissa ) / EXACT_POWERS_OF_TEN[ -exponent ] :
+                static_cast<double>( mantissa ) * EXACT_POWERS_OF_TEN[ exponent ];
+
+            value = negative ? -result : result;
+            return true;
+        }
+
+        std::istringstream stream( std::string( begin, it ) );
+        stream.imbue( std::locale::classic() );
+        stream >> value;
+        return !stream.fail();
+    }
+
+    inline bool read_number( char const *& it, char const * end, float & value )
+    {
+        double result;
+
+        if( !read_number( it, end, result ) )
+        {
+            return false;
+        }
+
+        value = static_cast<float>( result );
+        return true;
+    }
+
+    inline bool read_number( char const *& it, char const * end, int & value )
+    {
+        return read_int( it, end, value );
+    }
+
+    inline bool read_float( char const *& it, char const * end, float & value )
+    {
+        return read_number( it, end, value );
+    }
+
+    // property_tree translator that converts numbers with the readers above instead of a locale
+    // dependent istringstream per value
+    template <typename T>
+    struct NumberTranslator
+    {
+        typedef std::string internal_type;
+        typedef T external_type;
+
+        boost::optional<T> get_value( std::string const & text ) const
+        {
+            char const * it = text.data();
+            char const * const end = it + text.size();
+            T value;
+
+            if( !read_number( it, end, value ) )
+            {
+                return boost::optional<T>();
+            }
+
+            skip_ws( it, end );
+            return it == end ? boost::optional<T>( value ) : boost::optional<T>();
+        }
+    };
+
+    typedef NumberTranslator<float> FloatTranslator;
+    typedef NumberTranslator<int> IntTranslator;
+
+    bool read_bool( char const *& it, char const * end, bool & value )
+    {
+        skip_ws( it, end );
+
+        size_t const left = end - it;
+
+        if( left >= 4 && 0 == memcmp( it, "true", 4 ) )
+        {
+            value = true;
+            it += 4;
+            return true;
+        }
+
+        if( left >= 5 && 0 == memcmp( it, "false", 5 ) )
+        {
+            value = false;
+            it += 5;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Skips any JSON value, including nested objects and arrays
+    bool skip_value( char const *& it, char const * end )
+    {
+        skip_ws( it, end );
+
+        if( it == end )
+        {
+            return false;
+        }
+
+        if( *it == '"' )
+        {
+            char const * str;
+            size_t len;
+            return read_string( it, end, str, len );
+        }
+
+        if( *it == '{' || *it == '[' )
+        {
+            size_t depth = 0;
+
+            while( it != end )
+            {
+                char const c = *it;
+
+                if( c == '"' )
+                {
+                    char const * str;
+                    size_t len;
+
+                    if( !read_string( it, end, str, len ) )
+                    {
+                        return false;
+                    }
+                    continue;
+                }
+
+                ++it;
+
+                if( c == '{' || c == '[' )
+                {
+                    ++depth;
+                }
+                else if( ( c == '}' || c == ']' ) && --depth == 0 )
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // number or literal
+        char const * const begin = it;
+
+        while( it != end && *it != ',' && *it != '}' && *it != ']' &&
+            *it != ' ' && *it != '\t' && *it != '\r' && *it != '\n' )
+        {
+            ++it;
+        }
+
+        return it != begin;
+    }
+
+    bool read_point2d( char const *& it, char const * end, gtl::Point2D & point )
+    {
+        if( !consume( it, end, '{' ) )
+        {
+            return false;
+        }
+
+        unsigned int fields = 0;
+
+        do
+        {
+            char const * key;
+            size_t len;
+
+            if( !read_key( it, end, key, len ) )
+            {
+                return false;
+            }
+
+            bool const ok =
+                equals( key, len, "x" ) ? ( fields |= 1, read_float( it, end, point.x ) ) :
+                equals( key, len, "y" ) ? ( fields |= 2, read_float( it, end, point.y ) ) :
+                skip_value( it, end );
+
+            if( !ok )
+            {
+                return false;
+            }
+        }
+        while( consume( it, end, ',' ) );
+
+        return fields == 3 && consume( it, end, '}' );
+    }
+
+    bool read_eye( char const *& it, char const * end, gtl::Eye & eye )
+    {
+        if( !consume( it, end, '{' ) )
+        {
+            return false;
+        }
+
+        unsigned int fields = 0;
+
+        do
+        {
+            char const * key;
+            size_t len;
+
+            if( !read_key( it, end, key, len ) )
+            {
+                return false;
+            }
+
+            bool const ok =
+                equals( key, len, "raw" ) ? ( fields |= 1, read_point2d( it, end, eye.raw ) ) :
+                equals( key, len, "avg" ) ? ( fields |= 2, read_point2d( it, end, eye.avg ) ) :
+                equals( key, len, "psize" ) ? ( fields |= 4, read_float( it, end, eye.psize ) ) :
+                equals( key, len, "pcenter" ) ? ( fields |= 8, read_point2d( it, end, eye.pcenter ) ) :
+                skip_value( it, end );
+
+            if( !ok )
+            {
+                return false;
+            }
+        }
+        while( consume( it, end, ',' ) );
+
+        return fields == 15 && consume( it, end, '}' );
+    }
+}
+
 namespace gtl
 {
+    /* static */ void Parser::read_json( boost::property_tree::ptree & root, char const * begin, char const * end )
+    {
+        RangeStreamBuf buffer( begin, end );
+        std::istream stream( &buffer );
+        boost::property_tree::read_json( stream, root );
+    }
+
     /* static */ bool Parser::parse_description( std::string & description, boost::property_tree::ptree const & root )
     {
         OptionalPTree values = root.get_child_optional( "values" );
@@ -69,9 +528,9 @@ namespace gtl
         }
 
         calib_result.result = calibresult->get<bool>( "result" );
-        calib_result.deg = calibresult->get<float>( "deg" );
-        calib_result.degl = calibresult->get<float>( "degl" );
-        calib_result.degr = calibresult->get<float>( "degr" );
+        calib_result.deg = calibresult->get<float>( "deg", FloatTranslator() );
+        calib_result.degl = calibresult->get<float>( "degl", FloatTranslator() );
+        calib_result.degr = calibresult->get<float>( "degr", FloatTranslator() );
 
         OptionalPTree calibpoints = calibresult->get_child_optional( "calibpoints" );
 
@@ -89,24 +548,24 @@ namespace gtl
         {
             CalibPoint calib_point;
 
-            calib_point.state = it->second.get<int>( "state" );
+            calib_point.state = it->second.get<int>( "state", IntTranslator() );
             parse_point2d( calib_point.cp, it->second.get_child( "cp" ) );
             parse_point2d( calib_point.mecp, it->second.get_child( "mecp" ) );
 
             PTree const & acd = it->second.get_child( "acd" );
-            calib_point.acd.ad = acd.get<float>( "ad" );
-            calib_point.acd.adl = acd.get<float>( "adl" );
-            calib_point.acd.adr = acd.get<float>( "adr" );
+            calib_point.acd.ad = acd.get<float>( "ad", FloatTranslator() );
+            calib_point.acd.adl = acd.get<float>( "adl", FloatTranslator() );
+            calib_point.acd.adr = acd.get<float>( "adr", FloatTranslator() );
 
             PTree const & mepix = it->second.get_child( "mepix" );
-            calib_point.mepix.mep = mepix.get<float>( "mep" );
-            calib_point.mepix.mepl = mepix.get<float>( "mepl" );
-            calib_point.mepix.mepr = mepix.get<float>( "mepr" );
+            calib_point.mepix.mep = mepix.get<float>( "mep", FloatTranslator() );
+            calib_point.mepix.mepl = mepix.get<float>( "mepl", FloatTranslator() );
+            calib_point.mepix.mepr = mepix.get<float>( "mepr", FloatTranslator() );
 
             PTree const & asdp = it->second.get_child( "asdp" );
-            calib_point.asdp.asd = asdp.get<float>( "asd" );
-            calib_point.asdp.asdl = asdp.get<float>( "asdl" );
-            calib_point.asdp.asdr = asdp.get<float>( "asdr" );
+            calib_point.asdp.asd = asdp.get<float>( "asd", FloatTranslator() );
+            calib_point.asdp.asdl = asdp.get<float>( "asdl", FloatTranslator() );
+            calib_point.asdp.asdr = asdp.get<float>( "asdr", FloatTranslator() );
 
             calibpoints_vector.push_back( calib_point );
         }
@@ -150,26 +609,26 @@ namespace gtl
 
         if( has_gaze_data )
         {
-            gaze_data.time = frame->get<int>( "time" );
+            gaze_data.time = frame->get<int>( "time", IntTranslator() );
             gaze_data.fix = frame->get<bool>( "fix" );
-            gaze_data.state = frame->get<int>( "state" );
+            gaze_data.state = frame->get<int>( "state", IntTranslator() );
             parse_point2d( gaze_data.raw, frame->get_child( "raw" ) );
             parse_point2d( gaze_data.avg, frame->get_child( "avg" ) );
             parse_eye( gaze_data.lefteye, frame->get_child( "lefteye" ) );
             parse_eye( gaze_data.righteye, frame->get_child( "righteye" ) );
         }
 
-        server_state.version = values->get<int>( "version", server_state.version );
-        server_state.trackerstate = values->get<int>( "trackerstate", server_state.trackerstate );
-        server_state.framerate = values->get<int>( "framerate", server_state.framerate );
+        server_state.version = values->get<int>( "version", server_state.version, IntTranslator() );
+        server_state.trackerstate = values->get<int>( "trackerstate", server_state.trackerstate, IntTranslator() );
+        server_state.framerate = values->get<int>( "framerate", server_state.framerate, IntTranslator() );
         server_state.iscalibrated = values->get<bool>( "iscalibrated", server_state.iscalibrated );
         server_state.iscalibrating = values->get<bool>( "iscalibrating", server_state.iscalibrating );
 
-        screen.screenindex = values->get<int>( "screenindex", screen.screenindex );
-        screen.screenresw = values->get<int>( "screenresw", screen.screenresw );
-        screen.screenresh = values->get<int>( "screenresh", screen.screenresh );
-        screen.screenpsyw = values->get<float>( "screenpsyw", screen.screenpsyw );
-        screen.screenpsyh = values->get<float>( "screenpsyh", screen.screenpsyh );
+        screen.screenindex = values->get<int>( "screenindex", screen.screenindex, IntTranslator() );
+        screen.screenresw = values->get<int>( "screenresw", screen.screenresw, IntTranslator() );
+        screen.screenresh = values->get<int>( "screenresh", screen.screenresh, IntTranslator() );
+        screen.screenpsyw = values->get<float>( "screenpsyw", screen.screenpsyw, FloatTranslator() );
+        screen.screenpsyh = values->get<float>( "screenpsyh", screen.screenpsyh, FloatTranslator() );
         return true;
     }
 
@@ -214,8 +673,8 @@ namespace gtl
 
     /* static */ bool Parser::parse_point2d( Point2D & point, boost::property_tree::ptree const & object )
     {
-        point.x = object.get<float>( "x" );
-        point.y = object.get<float>( "y" );
+        point.x = object.get<float>( "x", FloatTranslator() );
+        point.y = object.get<float>( "y", FloatTranslator() );
         return true;
     }
 
@@ -223,11 +682,128 @@ namespace gtl
     {
         parse_point2d( eye.raw, object.get_child( "raw" ) );
         parse_point2d( eye.avg, object.get_child( "avg" ) );
-        eye.psize = object.get<float>( "psize" );
+        eye.psize = object.get<float>( "psize", FloatTranslator() );
         parse_point2d( eye.pcenter, object.get_child( "pcenter" ) );
         return true;
     }
 
+    /* static */ bool Parser::parse_frame( GazeData & gaze_data, char const *& it, char const * end )
+    {
+        if( !consume( it, end, '{' ) )
+        {
+            return false;
+        }
+
+        unsigned int fields = 0;
+
+        do
+        {
+            char const * key;
+            size_t len;
+
+            if( !read_key( it, end, key, len ) )
+            {
+                return false;
+            }
+
+            bool const ok =
+                equals( key, len, "time" ) ? ( fields |= 1, read_int( it, end, gaze_data.time ) ) :
+                equals( key, len, "fix" ) ? ( fields |= 2, read_bool( it, end, gaze_data.fix ) ) :
+                equals( key, len, "state" ) ? ( fields |= 4, read_int( it, end, gaze_data.state ) ) :
+                equals( key, len, "raw" ) ? ( fields |= 8, read_point2d( it, end, gaze_data.raw ) ) :
+                equals( key, len, "avg" ) ? ( fields |= 16, read_point2d( it, end, gaze_data.avg ) ) :
+                equals( key, len, "lefteye" ) ? ( fields |= 32, read_eye( it, end, gaze_data.lefteye ) ) :
+                equals( key, len, "righteye" ) ? ( fields |= 64, read_eye( it, end, gaze_data.righteye ) ) :
+                skip_value( it, end ); // e.g. "timestamp"
+
+            if( !ok )
+            {
+                return false;
+            }
+        }
+        while( consume( it, end, ',' ) );
+
+        return fields == 127 && consume( it, end, '}' );
+    }
+
+    /* static */ bool Parser::parse_frame_message( GazeData & gaze_data, char const * begin, char const * end )
+    {
+        char const * it = begin;
+
+        if( !consume( it, end, '{' ) )
+        {
+            return false;
+        }
 
+        bool is_tracker = false;
+        bool is_get = false;
+        bool is_ok = false;
+        bool has_frame = false;
 
+        do
+        {
+            char const * key;
+            size_t len;
+
+            if( !read_key( it, end, key, len ) )
+            {
+                return false;
+            }
+
+            if( equals( key, len, "category" ) )
+            {
+                char const * value;
+                size_t value_len;
+                is_tracker = read_string( it, end, value, value_len ) && equals( value, value_len, "tracker" );
+            }
+            else if( equals( key, len, "request" ) )
+            {
+                char const * value;
+                size_t value_len;
+                is_get = read_string( it, end, value, value_len ) && equals( value, value_len, "get" );
+            }
+            else if( equals( key, len, "statuscode" ) )
+            {
+                int status;
+                is_ok = read_int( it, end, status ) && status == 200;
+            }
+            else if( equals( key, len, "values" ) )
+            {
+                // Only a values object holding nothing but the frame is handled here
+                char const * values_key;
+                size_t values_key_len;
+
+                has_frame = consume( it, end, '{' ) &&
+                    read_key( it, end, values_key, values_key_len ) &&
+                    equals( values_key, values_key_len, "frame" ) &&
+                    parse_frame( gaze_data, it, end ) &&
+                    consume( it, end, '}' );
+
+                if( !has_frame )
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                return false; // "id" or anything else belongs to the generic parser
+            }
+        }
+        while( consume( it, end, ',' ) );
+
+        return consume( it, end, '}' ) && is_tracker && is_get && is_ok && has_frame;
+    }
+
+    /* static */ bool Parser::parse_frame_push( GazeData & gaze_data, char const * frame, char const * end )
+    {
+        char const * it = frame;
+
+        if( !parse_frame( gaze_data, it, end ) || !consume( it, end, '}' ) || !consume( it, end, '}' ) )
+        {
+            return false;
+        }
+
+        skip_ws( it, end );
+        return it == end;
+    }
 }
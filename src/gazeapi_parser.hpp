@@ -31,6 +31,27 @@ namespace gtl
         static bool parse_point2d( Point2D & point, boost::property_tree::ptree const & object );
         static bool parse_eye( Eye & eye, boost::property_tree::ptree const & object );
 
+        /** Read a JSON document into 'root' directly from the given bytes, without copying them first. */
+        static void read_json( boost::property_tree::ptree & root, char const * begin, char const * end );
+
+        /** Parse a pushed gaze frame directly from the raw message bytes.
+         *
+         * Only handles the tracker's frame schema, i.e. a 'get' reply whose values contain nothing but a
+         * "frame" object, and fills gaze_data without building a ptree or allocating. Returns false for
+         * anything else (replies with an id, notifications, additional values) so that the caller can
+         * fall back to the generic ptree based parsing.
+         */
+        static bool parse_frame_message( GazeData & gaze_data, char const * begin, char const * end );
+
+        /** Parse the remainder of a pushed gaze frame whose leading bytes have already been recognized.
+         *
+         * 'frame' points at the "frame" object inside "values"; the message must end right after it.
+         */
+        static bool parse_frame_push( GazeData & gaze_data, char const * frame, char const * end );
+
+        /** Parse a "frame" object starting at 'it', advancing 'it' past the closing brace. */
+        static bool parse_frame( GazeData & gaze_data, char const *& it, char const * end );
+
     private:
         typedef boost::property_tree::ptree PTree;
         typedef boost::optional<PTree const &> OptionalPTree;
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifndef _THEEYETRIBE_GAZEAPI_QUEUE_H_
+#define _THEEYETRIBE_GAZEAPI_QUEUE_H_
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <deque>
+
+
+namespace gtl
+{
+    /** Single-producer/single-consumer FIFO.
+     *
+     *  Items normally pass through a fixed ring buffer without locks. Should the consumer fall so far
+     *  behind that the ring fills up, the producer spills into a locked overflow deque instead of
+     *  blocking, and keeps doing so until the consumer has drained it, so ordering is preserved.
+     *
+     *  Popping swaps the item out of its slot, so for types like std::string the slots keep their
+     *  capacity and steady-state pushes do not allocate. push_swap() hands an item over the same way,
+     *  returning the slot's previous buffer to the producer, so items circulate as a pool.
+     */
+    template <typename T, std::size_t Capacity = 256>
+    class SpscQueue
+    {
+    public:
+        SpscQueue()
+            : m_head( 0 )
+            , m_tail( 0 )
+            , m_overflowed( false )
+        {}
+
+        // Producer side
+        void push( T const & item )
+        {
+            std::size_t const tail = m_tail.load( boost::memory_order_relaxed );
+
+            if( !m_overflowed.load( boost::memory_order_relaxed ) &&
+                tail - m_head.load( boost::memory_order_acquire ) < Capacity )
+            {
+                m_ring[ tail & MASK ] = item;
+                m_tail.store( tail + 1, boost::memory_order_release );
+                return;
+            }
+
+            boost::lock_guard<boost::mutex> lock( m_overflow_lock );
+            m_overflow.push_back( item );
+            m_overflowed.store( true, boost::memory_order_relaxed );
+        }
+
+        // Producer side; 'item' is left holding the previous content of its slot
+        void push_swap( T & item )
+        {
+            using std::swap;
+            std::size_t const tail = m_tail.load( boost::memory_order_relaxed );
+
+            if( !m_overflowed.load( boost::memory_order_relaxed ) &&
+                tail - m_head.load( boost::memory_order_acquire ) < Capacity )
+            {
+                swap( m_ring[ tail & MASK ], item );
+                m_tail.store( tail + 1, boost::memory_order_release );
+                return;
+            }
+
+            boost::lock_guard<boost::mutex> lock( m_overflow_lock );
+            m_overflow.push_back( T() );
+            swap( m_overflow.back(), item );
+            m_overflowed.store( true, boost::memory_order_relaxed );
+        }
+
+        // Consumer side
+        bool pop( T & item )
+        {
+            if( pop_ring( item ) )
+            {
+                return true;
+            }
+
+            if( !m_overflowed.load( boost::memory_order_relaxed ) )
+            {
+                return false;
+            }
+
+            boost::lock_guard<boost::mutex> lock( m_overflow_lock );
+
+            // The producer stops using the ring once it has overflowed, but it may have filled
+            // the ring after our first look at it
+            if( pop_ring( item ) )
+            {
+                return true;
+            }
+
+            if( m_overflow.empty() )
+            {
+                return false;
+            }
+
+            using std::swap;
+            swap( item, m_overflow.front() );
+            m_overflow.pop_front();
+
+            if( m_overflow.empty() )
+            {
+                m_overflowed.store( false, boost::memory_order_relaxed );
+            }
+            return true;
+        }
+
+        bool empty() const
+        {
+            return m_head.load( boost::memory_order_relaxed ) == m_tail.load( boost::memory_order_acquire ) &&
+                !m_overflowed.load( boost::memory_order_relaxed );
+        }
+
+    private:
+        bool pop_ring( T & item )
+        {
+            std::size_t const head = m_head.load( boost::memory_order_relaxed );
+
+            if( head == m_tail.load( boost::memory_order_acquire ) )
+            {
+                return false;
+            }
+
+            using std::swap;
+            swap( item, m_ring[ head & MASK ] );
+            m_head.store( head + 1, boost::memory_order_release );
+            return true;
+        }
+
+    private:
+        enum { MASK = Capacity - 1 };
+        typedef char CapacityMustBePowerOfTwo[ ( Capacity & MASK ) == 0 ? 1 : -1 ];
+
+        T                               m_ring[ Capacity ];
+        boost::atomic<std::size_t>      m_head;
+        char                            m_pad_head[ 64 ];
+        boost::atomic<std::size_t>      m_tail;
+        char                            m_pad_tail[ 64 ];
+        boost::atomic<bool>             m_overflowed;
+        boost::mutex                    m_overflow_lock;
+        std::deque<T>                   m_overflow;
+    };
+}
+
+#endif // _THEEYETRIBE_GAZEAPI_QUEUE_H_
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#include "gazeapi_runtime.hpp"
+
+
+namespace gtl
+{
+    GazeRuntime::Impl::Impl( unsigned int io_threads, unsigned int dispatch_threads,
+        GazeApiThreadOptions const & io_options, GazeApiThreadOptions const & dispatch_options )
+        : m_io_pool( io_threads, io_options )
+        , m_dispatch_pool( dispatch_threads, dispatch_options )
+    {
+    }
+
+    GazeRuntime::GazeRuntime( unsigned int io_threads, unsigned int dispatch_threads,
+        GazeApiThreadOptions const & io_options, GazeApiThreadOptions const & dispatch_options )
+        : m_impl( new Impl( io_threads, dispatch_threads, io_options, dispatch_options ) )
+    {
+    }
+
+    GazeRuntime::~GazeRuntime()
+    {
+    }
+}
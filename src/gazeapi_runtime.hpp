@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifndef _THEEYETRIBE_GAZEAPI_RUNTIME_H_
+#define _THEEYETRIBE_GAZEAPI_RUNTIME_H_
+
+#include "gazeapi.h"
+#include "gazeapi_thread.hpp"
+
+
+namespace gtl
+{
+    /** Threads of a GazeRuntime.
+     *
+     *  Network I/O of all sockets using the runtime is multiplexed on one io_service run by the I/O threads.
+     *  Received messages are dispatched by posting each connection's drain task to a second io_service run by
+     *  the dispatch threads, so a busy connection does not hold up the network I/O of the others.
+     */
+    class GazeRuntime::Impl
+    {
+    public:
+        Impl( unsigned int io_threads, unsigned int dispatch_threads,
+            GazeApiThreadOptions const & io_options, GazeApiThreadOptions const & dispatch_options );
+
+        boost::asio::io_service & io_service() { return m_io_pool.service(); }
+        boost::asio::io_service & dispatch_service() { return m_dispatch_pool.service(); }
+
+    private:
+        ThreadPool  m_io_pool;
+        ThreadPool  m_dispatch_pool;
+    };
+}
+
+#endif // _THEEYETRIBE_GAZEAPI_RUNTIME_H_
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifndef _THEEYETRIBE_GAZEAPI_SNAPSHOT_H_
+#define _THEEYETRIBE_GAZEAPI_SNAPSHOT_H_
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <cstring> // memcpy, memset
+
+
+namespace gtl
+{
+    /** Latest value of a plain data type (e.g. GazeData), published through a sequence lock.
+     *
+     *  Readers never block and never enter the kernel: they copy the value and retry only if a write
+     *  overlapped the copy. Writers are serialized among themselves by a mutex that readers never touch.
+     */
+    template <typename T>
+    class SeqLock
+    {
+    public:
+        SeqLock()
+            : m_sequence( 0 )
+        {
+            memset( &m_value, 0, sizeof( T ) );
+        }
+
+        void store( T const & value )
+        {
+            boost::lock_guard<boost::mutex> lock( m_write_lock );
+
+            unsigned int const sequence = m_sequence.load( boost::memory_order_relaxed );
+            m_sequence.store( sequence + 1, boost::memory_order_relaxed ); // odd: write in progress
+            boost::atomic_thread_fence( boost::memory_order_release );
+
+            memcpy( &m_value, &value, sizeof( T ) );
+
+            m_sequence.store( sequence + 2, boost::memory_order_release );
+        }
+
+        void load( T & value ) const
+        {
+            for( ;; )
+            {
+                unsigned int const before = m_sequence.load( boost::memory_order_acquire );
+
+                if( ( before & 1 ) == 0 )
+                {
+                    memcpy( &value, &m_value, sizeof( T ) );
+                    boost::atomic_thread_fence( boost::memory_order_acquire );
+
+                    if( m_sequence.load( boost::memory_order_relaxed ) == before )
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+
+        T load() const
+        {
+            T value;
+            load( value );
+            return value;
+        }
+
+    private:
+        boost::atomic<unsigned int> m_sequence;
+        T                           m_value;
+        boost::mutex                m_write_lock;
+    };
+
+    /** Latest value of a type that owns memory (e.g. CalibResult), published as an immutable snapshot.
+     *
+     *  Each store allocates a new snapshot and swaps it in atomically, so it suits rarely changing values.
+     *  Readers only take a reference to the current snapshot and never wait for a writer.
+     */
+    template <typename T>
+    class SharedSnapshot
+    {
+    public:
+        SharedSnapshot()
+            : m_value( new T() )
+        {}
+
+        void store( T const & value )
+        {
+            boost::shared_ptr<T const> const snapshot( new T( value ) );
+            boost::atomic_store( &m_value, snapshot );
+        }
+
+        boost::shared_ptr<T const> get() const
+        {
+            return boost::atomic_load( &m_value );
+        }
+
+        void load( T & value ) const
+        {
+            value = *get();
+        }
+
+    private:
+        boost::shared_ptr<T const>  m_value;
+    };
+}
+
+#endif // _THEEYETRIBE_GAZEAPI_SNAPSHOT_H_
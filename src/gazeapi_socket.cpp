@@ -21,25 +21,312 @@
 #endif
 
 #include "gazeapi_socket.hpp"
+#include "gazeapi_thread.hpp"
 
+#include <boost/chrono/ceil.hpp>
+
+#if defined( __AVX2__ )
+    #include <immintrin.h>
+#endif
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+    #define GTL_HAS_SSE2
+    #include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+
+namespace
+{
+#if defined( GTL_HAS_SSE2 )
+    inline unsigned int first_bit( unsigned int mask )
+    {
+    #ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward( &index, mask );
+        return index;
+    #else
+        return __builtin_ctz( mask );
+    #endif
+    }
+#endif
+
+    inline bool is_special( char const c )
+    {
+        return c == '{' || c == '}' || c == '"' || c == '\\';
+    }
+
+    // Returns the position of the next '{', '}', '"' or '\\' at or after 'pos', or 'size' if there is none
+    std::size_t find_special( char const * data, std::size_t pos, std::size_t const size )
+    {
+#if defined( __AVX2__ )
+        __m256i const open32 = _mm256_set1_epi8( '{' );
+        __m256i const close32 = _mm256_set1_epi8( '}' );
+        __m256i const quote32 = _mm256_set1_epi8( '"' );
+        __m256i const escape32 = _mm256_set1_epi8( '\\' );
+
+        for( ; pos + 32 <= size; pos += 32 )
+        {
+            __m256i const block = _mm256_loadu_si256( reinterpret_cast<__m256i const *>( data + pos ) );
+            __m256i const hits = _mm256_or_si256(
+                _mm256_or_si256( _mm256_cmpeq_epi8( block, open32 ), _mm256_cmpeq_epi8( block, close32 ) ),
+                _mm256_or_si256( _mm256_cmpeq_epi8( block, quote32 ), _mm256_cmpeq_epi8( block, escape32 ) ) );
+            unsigned int const mask = static_cast<unsigned int>( _mm256_movemask_epi8( hits ) );
+
+            if( mask != 0 )
+            {
+                return pos + first_bit( mask );
+            }
+        }
+#endif
+#if defined( GTL_HAS_SSE2 )
+        __m128i const open = _mm_set1_epi8( '{' );
+        __m128i const close = _mm_set1_epi8( '}' );
+        __m128i const quote = _mm_set1_epi8( '"' );
+        __m128i const escape = _mm_set1_epi8( '\\' );
+
+        for( ; pos + 16 <= size; pos += 16 )
+        {
+            __m128i const block = _mm_loadu_si128( reinterpret_cast<__m128i const *>( data + pos ) );
+            __m128i const hits = _mm_or_si128(
+                _mm_or_si128( _mm_cmpeq_epi8( block, open ), _mm_cmpeq_epi8( block, close ) ),
+                _mm_or_si128( _mm_cmpeq_epi8( block, quote ), _mm_cmpeq_epi8( block, escape ) ) );
+            unsigned int const mask = static_cast<unsigned int>( _mm_movemask_epi8( hits ) );
+
+            if( mask != 0 )
+            {
+                return pos + first_bit( mask );
+            }
+        }
+#endif
+        while( pos < size && !is_special( data[ pos ] ) )
+        {
+            ++pos;
+        }
+        return pos;
+    }
+
+    inline bool is_space( char const c )
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    // Whether the string opening at 'quote' is an object key, i.e. follows '{' or ',' rather than ':'
+    bool is_key_position( char const * message, std::size_t quote )
+    {
+        while( quote > 0 && is_space( message[ quote - 1 ] ) )
+        {
+            --quote;
+        }
+        return quote > 0 && ( message[ quote - 1 ] == '{' || message[ quote - 1 ] == ',' );
+    }
+
+    // Reads the integer value following an "id" key, i.e. ': 123'. Returns false if no colon follows, as
+    // for a string within an array, and sets 'id' to -1 if the value is not an integer.
+    bool read_id_value( char const * it, char const * end, int & id )
+    {
+        while( it != end && is_space( *it ) )
+        {
+            ++it;
+        }
+
+        if( it == end || *it != ':' )
+        {
+            return false;
+        }
+
+        ++it;
+        while( it != end && is_space( *it ) )
+        {
+            ++it;
+        }
+
+        bool const negative = it != end && *it == '-';
+        if( negative )
+        {
+            ++it;
+        }
+
+        id = -1;
+        if( it == end || *it < '0' || *it > '9' )
+        {
+            return true;
+        }
+
+        int value = 0;
+        for( ; it != end && *it >= '0' && *it <= '9'; ++it )
+        {
+            value = value * 10 + ( *it - '0' );
+        }
+        id = negative ? -value : value;
+        return true;
+    }
+
+    // The server writes pushed frames with a fixed leading layout, so comparing the first bytes is enough to
+    // recognize one. Anything laid out differently is simply treated as a generic message.
+    char const FRAME_PUSH_PREFIX[] = "{\"category\":\"tracker\",\"request\":\"get\",\"statuscode\":200,\"values\":{\"frame\":";
+
+    void classify_message( gtl::ReceivedMessage & message )
+    {
+        std::size_t const length = sizeof( FRAME_PUSH_PREFIX ) - 1;
+        std::size_t const begin = message.text.find_first_not_of( " \t\r\n" );
+
+        if( message.id == -1 && begin != std::string::npos && message.text.compare( begin, length, FRAME_PUSH_PREFIX ) == 0 )
+        {
+            message.kind = gtl::MK_FRAME_PUSH;
+            message.payload = begin + length;
+        }
+        else
+        {
+            message.kind = gtl::MK_GENERIC;
+            message.payload = 0;
+        }
+    }
+}
 
 namespace gtl
 {
     JSONPackageMatcher::JSONPackageMatcher()
-        : m_stack( 0 )
-        , m_in_message( false )
+        : m_in_message( false )
+        , m_in_string( false )
+        , m_escape( false )
+        , m_stack( 0 )
+        , m_offset( 0 )
+        , m_key_begin( 0 )
+        , m_id_value( 0 )
+        , m_id( -1 )
+        , m_last_id( -1 )
     {}
 
-    Socket::Socket( int verbose_level )
-        : m_io_service()
+    std::size_t JSONPackageMatcher::scan( char const * data, std::size_t size, bool & complete )
+    {
+        std::size_t i = 0;
+        char const * const message = data - m_offset; // Earlier blocks of this message precede 'data'
+
+        if( m_escape && size > 0 )
+        {
+            m_escape = false;
+            i = 1; // escaped character was split from its backslash by the previous read
+        }
+
+        while( ( i = find_special( data, i, size ) ) < size )
+        {
+            // The value of an "id" key ends at the next brace or quote, so it can be read now
+            if( m_id_value != 0 && !m_in_string )
+            {
+                read_id_value( message + m_id_value, data + i, m_id );
+                m_id_value = 0;
+            }
+
+            char const c = data[ i++ ];
+
+            if( m_in_string )
+            {
+                if( c == '"' )
+                {
+                    m_in_string = false;
+
+                    std::size_t const key_end = m_offset + i - 1;
+                    if( m_key_begin != 0 && key_end - m_key_begin == 2 && message[ m_key_begin ] == 'i' && message[ m_key_begin + 1 ] == 'd' )
+                    {
+                        m_id_value = key_end + 1;
+                    }
+                    m_key_begin = 0;
+                }
+                else if( c == '\\' )
+                {
+                    if( i == size )
+                    {
+                        m_escape = true;
+                    }
+                    else
+                    {
+                        ++i;
+                    }
+                }
+                continue;
+            }
+
+            if( c == '"' )
+            {
+                m_in_string = m_in_message;
+                // Only a top level key can be "id"; a string value such as "category":"id" is skipped
+                std::size_t const begin = m_offset + i;
+                m_key_begin = m_in_message && m_stack == 1 && is_key_position( message, begin - 1 ) ? begin : 0;
+            }
+            else if( c == '{' )
+            {
+                if( !m_in_message )
+                {
+                    m_id = -1;
+                }
+
+                ++m_stack;
+                m_in_message = true;
+            }
+            else if( c == '}' && m_in_message && --m_stack == 0 )
+            {
+                while( i < size && data[ i ] != '{' )
+                {
+                    ++i; // read all post-amble until next message starts (\r, \n, etc.)
+                }
+
+                m_in_message = false;
+                m_offset = 0;
+                m_last_id = m_id;
+                complete = true;
+                return i;
+            }
+        }
+
+        m_offset += size;
+        complete = false;
+        return size;
+    }
+
+    Socket::Socket( int verbose_level, bool polled )
+        : m_own_io_service( new boost::asio::io_service() )
+        , m_io_service( *m_own_io_service )
+        , m_shared( false )
+        , m_operations( 0 )
+        , m_strand( m_io_service )
         , m_socket( m_io_service )
-        , m_handler( *this )
+        , m_poll_timer( m_io_service )
+        , m_polled( polled )
+        , m_handler( *this, polled ? DM_POLLED : DM_THREAD )
         , m_verbose( verbose_level )
-        , m_sync_id( -1 )
-    {}
+        , m_write_in_progress( false )
+        , m_connection( 0 )
+    {
+        m_outgoing.reserve( 4096 );
+        m_writing.reserve( 4096 );
+    }
+
+    Socket::Socket( boost::asio::io_service & io_service, boost::asio::io_service & dispatch_service, int verbose_level )
+        : m_io_service( io_service )
+        , m_shared( true )
+        , m_operations( 0 )
+        , m_strand( m_io_service )
+        , m_socket( m_io_service )
+        , m_poll_timer( m_io_service )
+        , m_polled( false )
+        , m_handler( *this, DM_POOL, &dispatch_service )
+        , m_verbose( verbose_level )
+        , m_write_in_progress( false )
+        , m_connection( 0 )
+    {
+        m_outgoing.reserve( 4096 );
+        m_writing.reserve( 4096 );
+    }
 
     Socket::~Socket()
     {
+        if( m_shared )
+        {
+            shutdown();
+        }
+
         if( m_thread.joinable() )
         {
             m_thread.join();
@@ -54,6 +341,12 @@ namespace gtl
             m_thread.join();
         }
 
+        if( m_shared )
+        {
+            // Likewise, handlers of a previous connection may still be running on the shared threads
+            wait_operations();
+        }
+
         using namespace boost::asio::ip;
 
         tcp::resolver resolver( m_io_service );
@@ -74,15 +367,43 @@ namespace gtl
             return false;
         }
 
-        boost::asio::async_read_until( m_socket, m_buffer, m_matcher,
-            boost::bind( &Socket::on_read,
+        // Requests are small and already gathered into one write, so do not let Nagle hold them back
+        m_socket.set_option( tcp::no_delay( true ), error );
+
+        {
+            // Writes still pending from a previous connection were abandoned when it was closed. Their
+            // handlers, like those of its reads, may still be queued on our own io_service and run once it
+            // is restarted, so they are told apart by the connection they were started for.
+            boost::lock_guard<boost::mutex> lock( m_write_lock );
+            ++m_connection;
+            m_outgoing.clear();
+            m_writing.clear();
+            m_write_in_progress = false;
+        }
+
+        m_buffer.consume( m_buffer.size() );
+        m_matcher = JSONPackageMatcher(); // Forget any message cut off by a previous connection
+
+        begin_operation();
+        boost::asio::async_read_until( m_socket, m_buffer, JSONPackageMatcherRef( m_matcher ),
+            m_strand.wrap( boost::bind( &Socket::on_read,
             this,
             boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred ) );
+            boost::asio::placeholders::bytes_transferred,
+            m_connection ) ) );
+
+        if( m_shared )
+        {
+            return true; // The runtime's threads run the io_service
+        }
 
-        // Keep io_service processing requests in a separate thread
         m_io_service.reset();
-        m_thread = boost::thread( boost::bind( ( size_t( boost::asio::io_service::* )( ) ) &boost::asio::io_service::run, &m_io_service ) );
+
+        if( !m_polled )
+        {
+            // Keep io_service processing requests in a separate thread
+            m_thread = boost::thread( boost::bind( &Socket::run_io_thread, this ) );
+        }
 
         return true;
     }
@@ -93,7 +414,27 @@ namespace gtl
         {
             m_socket.close();
         }
-        m_io_service.stop(); // stops io_service and exits thread
+
+        if( !m_shared )
+        {
+            m_io_service.stop(); // stops io_service and exits thread
+        }
+
+        // No reply will arrive anymore, so release any blocking request
+        complete_all_requests();
+    }
+
+    void Socket::shutdown()
+    {
+        disconnect();
+
+        if( m_shared )
+        {
+            // The io_service lives on, so wait until no handler refers to this socket anymore
+            wait_operations();
+        }
+
+        m_handler.stop();
     }
 
     bool Socket::handle_connection_state()
@@ -101,61 +442,274 @@ namespace gtl
         return true;
     }
 
-    int Socket::get_id( std::string const & message ) const
+    bool Socket::send( std::string const & message )
     {
-        size_t const pos = message.find( "\"id\":" );
-        int const id = pos != std::string::npos ? std::atoi( &message[pos + 5] ) : -1;    // sizeof( "id": ) == 5
-        return id;
+        return send( message.data(), message.size() );
     }
 
-    bool Socket::send( std::string const & message )
+    bool Socket::send( char const * data, std::size_t size )
     {
-        size_t const size = message.size();
-        char * data = new char[ size ];
-        memcpy( data, message.c_str(), size );
+        {
+            boost::lock_guard<boost::mutex> lock( m_write_lock );
+            m_outgoing.insert( m_outgoing.end(), data, data + size );
 
-        boost::asio::async_write( m_socket,
-            boost::asio::buffer( data, size ),
-            boost::bind( &Socket::on_write, this, boost::asio::placeholders::error, data ) );
+            if( !m_write_in_progress )
+            {
+                start_write();
+            }
+        }
 
         if( m_verbose > 0 )
         {
-            std::cout << "Send: " << message << std::endl << std::flush;
+            std::cout << "Send: " << std::string( data, size ) << std::endl << std::flush;
         }
 
         return true;
     }
 
-    bool Socket::send_sync( std::string const & message )
+    // Must be called with m_write_lock held
+    void Socket::start_write()
+    {
+        m_writing.swap( m_outgoing );
+        m_write_in_progress = true;
+
+        begin_operation();
+        boost::asio::async_write( m_socket,
+            boost::asio::buffer( m_writing ),
+            m_strand.wrap( boost::bind( &Socket::on_write, this, boost::asio::placeholders::error, m_connection ) ) );
+    }
+
+    bool Socket::send_request( int id, char const * data, std::size_t size, unsigned int timeout_ms )
     {
-        int const id = get_id( message );
-        if( id == -1 )
         {
-            return false;
+            boost::lock_guard<boost::mutex> lock( m_sync_lock );
+            m_pending.insert( id );
+
+            if( timeout_ms > 0 )
+            {
+                boost::shared_ptr<boost::asio::deadline_timer> timer( new boost::asio::deadline_timer( m_io_service ) );
+                timer->expires_from_now( boost::posix_time::milliseconds( timeout_ms ) );
+                begin_operation();
+                timer->async_wait( m_strand.wrap( boost::bind( &Socket::on_request_timeout, this, boost::asio::placeholders::error, id ) ) );
+                m_timers[ id ] = timer;
+            }
         }
-        assert( m_sync_id == -1 );
-        m_sync_id = id;
+
         if( m_verbose > 0 )
         {
-            std::cout << "Sync [id: " << id << "] begun"<< std::endl << std::flush;
+            std::cout << "Request [id: " << id << "] begun" << std::endl << std::flush;
         }
-        send( message );
-        while( m_sync_id == id )
+
+        return send( data, size );
+    }
+
+    bool Socket::wait_request( int id )
+    {
+        if( m_polled )
+        {
+            // Nobody else reads from the socket, so do it here until the reply has been dispatched. Other
+            // messages stay queued for the next poll().
+            while( is_pending( id ) && m_socket.is_open() && !m_io_service.stopped() )
+            {
+                run_io( 100 );
+            }
+        }
+
+        boost::unique_lock<boost::mutex> lock( m_sync_lock );
+        while( !m_polled && m_pending.count( id ) != 0 && m_socket.is_open() )
         {
-            boost::this_thread::sleep_for( boost::chrono::milliseconds( 1 ) );
+            m_sync_done.wait( lock );
         }
+
+        bool const completed = m_pending.erase( id ) == 0 && m_abandoned.erase( id ) == 0;
         if( m_verbose > 0 )
         {
-            std::cout << "Sync [id: " << id << "] done" << std::endl << std::flush;
+            std::cout << "Request [id: " << id << "] " << ( completed ? "done" : "failed" ) << std::endl << std::flush;
+        }
+        return completed;
+    }
+
+    bool Socket::set_thread_options( GazeApiThreadRole role, GazeApiThreadOptions const & options )
+    {
+        if( m_polled || m_shared )
+        {
+            return false;
+        }
+
+        if( role == GATR_DISPATCH )
+        {
+            m_handler.set_thread_options( options );
+            return true;
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lock( m_thread_options_lock );
+            m_io_thread_options = options;
+        }
+
+        // Reaches a running I/O thread; otherwise the options are applied when connect() starts one
+        if( m_thread.joinable() && !m_io_service.stopped() )
+        {
+            m_io_service.post( boost::bind( &Socket::apply_io_thread_options, this ) );
         }
         return true;
     }
 
-    void Socket::on_read( boost::system::error_code const & error, size_t bytes_transferred )
+    void Socket::run_io_thread()
+    {
+        apply_io_thread_options();
+        m_io_service.run();
+    }
+
+    void Socket::apply_io_thread_options()
+    {
+        GazeApiThreadOptions options;
+        {
+            boost::lock_guard<boost::mutex> lock( m_thread_options_lock );
+            options = m_io_thread_options;
+        }
+
+        if( !apply_thread_options( options ) && m_verbose > 0 )
+        {
+            std::cout << "Options of I/O thread could not all be applied" << std::endl << std::flush;
+        }
+    }
+
+    void Socket::set_frame_coalescing( bool enabled )
+    {
+        m_handler.set_frame_coalescing( enabled );
+    }
+
+    std::size_t Socket::poll()
+    {
+        m_io_service.poll();
+        return m_handler.dispatch_pending();
+    }
+
+    std::size_t Socket::run_for( unsigned int timeout_ms )
+    {
+        boost::chrono::steady_clock::time_point const deadline = boost::chrono::steady_clock::now() + boost::chrono::milliseconds( timeout_ms );
+
+        // A handler run by run_io() may just be part of a message, a write or a timer, so keep going until
+        // something has been dispatched
+        for( ;; )
+        {
+            std::size_t const count = m_handler.dispatch_pending();
+            boost::chrono::steady_clock::time_point const now = boost::chrono::steady_clock::now();
+
+            if( count != 0 || now >= deadline )
+            {
+                return count;
+            }
+
+            run_io( static_cast<unsigned int>( boost::chrono::ceil<boost::chrono::milliseconds>( deadline - now ).count() ) );
+        }
+    }
+
+    // Runs the first handler that becomes ready within timeout_ms, plus any others ready by then
+    void Socket::run_io( unsigned int timeout_ms )
+    {
+        if( m_io_service.stopped() )
+        {
+            // Not connected, so there is nothing to wait for
+            boost::this_thread::sleep_for( boost::chrono::milliseconds( timeout_ms ) );
+            return;
+        }
+
+        m_poll_timer.expires_from_now( boost::posix_time::milliseconds( timeout_ms ) );
+        m_poll_timer.async_wait( &Socket::on_poll_timer );
+
+        m_io_service.run_one();
+        m_poll_timer.cancel();
+        m_io_service.poll(); // also completes the cancelled timer
+    }
+
+    /* static */ void Socket::on_poll_timer( boost::system::error_code const & /*error*/ )
+    {
+        // Only bounds the wait in run_io()
+    }
+
+    bool Socket::is_pending( int id )
+    {
+        boost::lock_guard<boost::mutex> lock( m_sync_lock );
+        return m_pending.count( id ) != 0;
+    }
+
+    void Socket::complete_request( int id, bool replied )
+    {
+        {
+            boost::lock_guard<boost::mutex> lock( m_sync_lock );
+            if( m_pending.erase( id ) == 0 )
+            {
+                return; // Already completed or timed out
+            }
+
+            std::map<int, boost::shared_ptr<boost::asio::deadline_timer> >::iterator it = m_timers.find( id );
+            if( it != m_timers.end() )
+            {
+                it->second->cancel();
+                m_timers.erase( it );
+            }
+
+            m_sync_done.notify_all();
+        }
+
+        Observable<ISocketListener>::ObserverVector const observers = get_observers();
+        for( size_t i = 0; i < observers.size(); ++i )
+        {
+            observers[i]->on_request_completed( id, replied );
+        }
+    }
+
+    void Socket::complete_all_requests()
     {
+        boost::lock_guard<boost::mutex> lock( m_sync_lock );
+
+        std::map<int, boost::shared_ptr<boost::asio::deadline_timer> >::iterator it = m_timers.begin();
+        for( ; it != m_timers.end(); ++it )
+        {
+            it->second->cancel();
+        }
+        m_timers.clear();
+
+        // No reply to these can arrive anymore, and the owner fails the handlers of its async requests
+        // itself. Forget them so they cannot match a reply on the next connection; only a waiter that has
+        // not reached wait_request() yet still needs to learn that its request failed.
+        m_abandoned.clear();
+        m_abandoned.swap( m_pending );
+
+        m_sync_done.notify_all();
+    }
+
+    void Socket::on_request_timeout( boost::system::error_code const & error, int id )
+    {
+        OperationScope const scope( *this );
+
+        if( error != boost::asio::error::operation_aborted )
+        {
+            if( m_verbose > 0 )
+            {
+                std::cout << "Request [id: " << id << "] timed out" << std::endl << std::flush;
+            }
+            complete_request( id, false );
+        }
+    }
+
+    void Socket::on_read( boost::system::error_code const & error, size_t bytes_transferred, unsigned int connection )
+    {
+        OperationScope const scope( *this );
+
+        if( error == boost::asio::error::operation_aborted || connection != m_connection )
+        {
+            // The socket was closed locally. As disconnect() stops the io_service, this may only run once
+            // it is restarted by the next connect(), so it must not report that connection as lost, nor
+            // read from the next one.
+            return;
+        }
+
         if( error )
         {
-            Observable<ISocketListener>::ObserverVector const & observers = get_observers();
+            Observable<ISocketListener>::ObserverVector const observers = get_observers();
             for( size_t i = 0; i < observers.size(); ++i )
             {
                 observers[i]->on_disconnected();
@@ -163,109 +717,396 @@ namespace gtl
         }
         else
         {
-            typedef boost::asio::streambuf::const_buffers_type buffer_type;
-            typedef boost::asio::buffers_iterator<buffer_type> iterator;
+            extract_message( bytes_transferred, m_matcher.id() );
 
-            buffer_type input = m_buffer.data();
+            // After a stall the buffer usually holds a burst of complete messages. Split them off here,
+            // continuing the scan where the previous message ended, rather than one read per message.
+            for( ;; )
+            {
+                boost::asio::streambuf::const_buffers_type const input = m_buffer.data();
+                std::size_t const size = boost::asio::buffer_size( input );
 
-            std::string reply; reply.reserve( bytes_transferred );
-            std::copy( iterator::begin( input ), iterator::begin( input ) + bytes_transferred, std::back_inserter( reply ) );
-            m_buffer.consume( bytes_transferred );
+                JSONPackageMatcher matcher;
+                bool complete = false;
+                std::size_t const length = size == 0 ? 0 : matcher.scan( boost::asio::buffer_cast<char const *>( input ), size, complete );
 
-            if( m_verbose > 1 )
-            {
-                std::cout << "Recv: " << reply << std::endl << std::flush;
-            }
+                if( !complete )
+                {
+                    break;
+                }
 
-            m_handler.process_message( reply );
+                extract_message( length, matcher.id() );
+            }
 
-            boost::asio::async_read_until( m_socket, m_buffer, m_matcher,
-                boost::bind( &Socket::on_read,
+            begin_operation();
+            boost::asio::async_read_until( m_socket, m_buffer, JSONPackageMatcherRef( m_matcher ),
+                m_strand.wrap( boost::bind( &Socket::on_read,
                 this,
                 boost::asio::placeholders::error,
-                boost::asio::placeholders::bytes_transferred ) );
+                boost::asio::placeholders::bytes_transferred,
+                connection ) ) );
         }
     }
 
-    void Socket::on_write( const boost::system::error_code& error, char* data )
+    void Socket::extract_message( std::size_t size, int id )
     {
-        if( error )
+        // m_message is a recycled buffer, so once warmed up this does not allocate
+        m_message.text.assign( boost::asio::buffer_cast<char const *>( m_buffer.data() ), size );
+        m_message.id = id;
+        classify_message( m_message );
+        m_buffer.consume( size );
+
+        if( m_verbose > 1 )
         {
-            Observable<ISocketListener>::ObserverVector const & observers = get_observers();
+            std::cout << "Recv: " << m_message.text << std::endl << std::flush;
+        }
 
-            for( size_t i = 0; i < observers.size(); ++i )
+        m_handler.process_message( m_message );
+    }
+
+    void Socket::on_write( const boost::system::error_code& error, unsigned int connection )
+    {
+        OperationScope const scope( *this );
+
+        if( error == boost::asio::error::operation_aborted )
+        {
+            return; // The socket was closed locally; connect() resets the write state
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lock( m_write_lock );
+            if( connection != m_connection )
             {
-                observers[ i ]->on_disconnected();
+                return; // Completed just before the previous connection was closed; m_writing is no longer ours
             }
+
+            if( !error )
+            {
+                m_writing.clear(); // keeps its capacity for the next swap
+
+                if( m_outgoing.empty() )
+                {
+                    m_write_in_progress = false;
+                }
+                else
+                {
+                    start_write();
+                }
+                return;
+            }
+
+            m_outgoing.clear();
+            m_writing.clear();
+            m_write_in_progress = false;
+        }
+
+        Observable<ISocketListener>::ObserverVector const observers = get_observers();
+
+        for( size_t i = 0; i < observers.size(); ++i )
+        {
+            observers[ i ]->on_disconnected();
+        }
+    }
+
+    void Socket::begin_operation()
+    {
+        boost::lock_guard<boost::mutex> lock( m_operations_lock );
+        ++m_operations;
+    }
+
+    void Socket::end_operation()
+    {
+        boost::lock_guard<boost::mutex> lock( m_operations_lock );
+        if( --m_operations == 0 )
+        {
+            m_operations_done.notify_all();
         }
+    }
 
-        delete[] data;
+    // Only meaningful with a shared io_service: an own one drops its handlers when stopped, without running them
+    void Socket::wait_operations()
+    {
+        boost::unique_lock<boost::mutex> lock( m_operations_lock );
+        while( m_operations != 0 )
+        {
+            m_operations_done.wait( lock );
+        }
     }
 
-    HandleMessages::HandleMessages( Socket & owner )
+    HandleMessages::HandleMessages( Socket & owner, DispatchMode mode, boost::asio::io_service * pool )
         : m_owner( owner )
         , m_terminate( false )
+        , m_sleeping( false )
+        , m_pool( mode == DM_POOL ? pool : 0 )
+        , m_scheduled( false )
+        , m_coalesce_frames( false )
+        , m_frame_pending( false )
+        , m_thread_options_changed( false )
     {
-        m_thread = boost::thread( boost::bind( &HandleMessages::run, this ) );
+        if( mode == DM_THREAD )
+        {
+            m_thread = boost::thread( boost::bind( &HandleMessages::run, this ) );
+        }
     }
 
     HandleMessages::~HandleMessages()
+    {
+        stop();
+    }
+
+    void HandleMessages::stop()
     {
         terminate();
         if( m_thread.joinable() )
         {
             m_thread.join();
         }
+
+        // A drain task still posted to the pool returns at once, as m_terminate is set. Called from within
+        // a running drain task, e.g. by destroying the GazeApi from one of its listeners, this never
+        // returns, which is why the GazeApi documents that as not allowed.
+        while( m_scheduled.load( boost::memory_order_acquire ) )
+        {
+            boost::this_thread::yield();
+        }
     }
 
-    void HandleMessages::on_message( std::string const & message )
+    void HandleMessages::on_message( ReceivedMessage const & message )
     {
-        Observable<ISocketListener>::ObserverVector const & observers = m_owner.get_observers();
+        Observable<ISocketListener>::ObserverVector const observers = m_owner.get_observers();
         for( size_t i = 0; i < observers.size(); ++i )
         {
             observers[i]->on_message( message );
         }
     }
 
-    void HandleMessages::process_message( std::string const & message )
+    void HandleMessages::on_messages_drained()
     {
-        // Validate if message contain an id, and if we currently have a blocking request with that id
+        Observable<ISocketListener>::ObserverVector const observers = m_owner.get_observers();
+        for( size_t i = 0; i < observers.size(); ++i )
         {
-            int const id = m_owner.get_id( message );
-            if( id != -1 && m_owner.m_sync_id == id )
+            observers[i]->on_messages_drained();
+        }
+    }
+
+    void HandleMessages::process_message( ReceivedMessage & message )
+    {
+        // Replies to in-flight requests are dispatched right away, ahead of anything queued
+        {
+            int const id = message.id;
+            if( id != -1 && m_owner.is_pending( id ) )
             {
                 on_message( message );
-                m_owner.m_sync_id = -1;
+                m_owner.complete_request( id, true );
                 return;
             }
+
+            // When coalescing, a pushed frame that has not been dispatched yet is simply replaced; the queue
+            // holds an empty placeholder marking where the latest frame is to be dispatched.
+            if( message.kind == MK_FRAME_PUSH && m_coalesce_frames.load( boost::memory_order_relaxed ) )
+            {
+                {
+                    boost::lock_guard<boost::mutex> lock( m_frame_lock );
+                    swap( m_latest_frame, message );
+                    if( m_frame_pending )
+                    {
+                        return;
+                    }
+                    m_frame_pending = true;
+                }
+
+                m_frame_queue.push( ReceivedMessage() );
+                wake();
+                return;
+            }
+        }
+
+        if( message.kind == MK_FRAME_PUSH )
+        {
+            m_frame_queue.push_swap( message );
+        }
+        else
+        {
+            m_control_queue.push_swap( message );
+        }
+        wake();
+    }
+
+    void HandleMessages::set_frame_coalescing( bool enabled )
+    {
+        m_coalesce_frames = enabled;
+    }
+
+    void HandleMessages::wake()
+    {
+        if( m_pool )
+        {
+            schedule();
+            return;
+        }
+
+        // Pairs with the fence in run(): either the dispatch thread sees the new message before
+        // going to sleep, or we see that it sleeps and notify it. Only then is the lock taken.
+        boost::atomic_thread_fence( boost::memory_order_seq_cst );
+
+        if( m_sleeping.load( boost::memory_order_relaxed ) )
+        {
+            boost::lock_guard<boost::mutex> lock( m_lock );
+            m_wakeup.notify_one();
         }
-        m_lock.lock();
-        m_queue.push_back( message );
-        m_lock.unlock();
     }
 
     void HandleMessages::terminate()
     {
+        boost::lock_guard<boost::mutex> lock( m_lock );
         m_terminate = true;
+        m_wakeup.notify_one();
+    }
+
+    void HandleMessages::schedule()
+    {
+        // Pairs with the fence in drain(): either the drain task sees the new message before it finishes,
+        // or we see that it has finished and post another one
+        boost::atomic_thread_fence( boost::memory_order_seq_cst );
+
+        bool expected = false;
+        if( !m_scheduled.load( boost::memory_order_relaxed ) &&
+            m_scheduled.compare_exchange_strong( expected, true, boost::memory_order_acq_rel ) )
+        {
+            m_pool->post( boost::bind( &HandleMessages::drain, this ) );
+        }
+    }
+
+    // Runs on a pool thread. m_scheduled keeps other pool threads out, so messages are dispatched in order.
+    void HandleMessages::drain()
+    {
+        std::size_t count = 0;
+        while( !m_terminate && count < DRAIN_BATCH && dispatch_next( m_polled_message ) )
+        {
+            ++count;
+        }
+
+        if( m_terminate )
+        {
+            m_scheduled.store( false, boost::memory_order_release );
+            return;
+        }
+
+        if( count == DRAIN_BATCH )
+        {
+            // Possibly more to do, but give the other connections sharing the pool a turn first
+            m_pool->post( boost::bind( &HandleMessages::drain, this ) );
+            return;
+        }
+
+        on_messages_drained();
+
+        m_scheduled.store( false, boost::memory_order_release );
+        boost::atomic_thread_fence( boost::memory_order_seq_cst );
+
+        if( !empty() )
+        {
+            schedule();
+        }
+    }
+
+    void HandleMessages::set_thread_options( GazeApiThreadOptions const & options )
+    {
+        boost::lock_guard<boost::mutex> lock( m_lock );
+        m_thread_options = options;
+        m_thread_options_changed = true;
+        m_wakeup.notify_one();
+    }
+
+    void HandleMessages::apply_thread_options()
+    {
+        GazeApiThreadOptions options;
+        {
+            boost::lock_guard<boost::mutex> lock( m_lock );
+            options = m_thread_options;
+            m_thread_options_changed = false;
+        }
+
+        if( !gtl::apply_thread_options( options ) && m_owner.m_verbose > 0 )
+        {
+            std::cout << "Options of dispatch thread could not all be applied" << std::endl << std::flush;
+        }
     }
 
     void HandleMessages::run()
     {
+        ReceivedMessage message;
+
         while( !m_terminate )
         {
-            if( m_queue.empty() )
+            if( m_thread_options_changed )
             {
-                boost::this_thread::sleep_for( boost::chrono::milliseconds( 1 ) );
+                apply_thread_options();
             }
-            else
+
+            if( dispatch_next( message ) )
             {
-                m_lock.lock();
-                std::string const message = m_queue.front();
-                m_queue.pop_front();
-                m_lock.unlock();
-                on_message( message );
+                continue;
+            }
+
+            on_messages_drained();
+
+            boost::unique_lock<boost::mutex> lock( m_lock );
+            m_sleeping.store( true, boost::memory_order_relaxed );
+            boost::atomic_thread_fence( boost::memory_order_seq_cst );
+
+            while( !m_terminate && empty() && !m_thread_options_changed )
+            {
+                m_wakeup.wait( lock );
             }
+
+            m_sleeping.store( false, boost::memory_order_relaxed );
         }
     }
 
+    std::size_t HandleMessages::dispatch_pending()
+    {
+        std::size_t count = 0;
+        while( dispatch_next( m_polled_message ) )
+        {
+            ++count;
+        }
+
+        if( count > 0 )
+        {
+            on_messages_drained();
+        }
+        return count;
+    }
+
+    bool HandleMessages::dispatch_next( ReceivedMessage & message )
+    {
+        if( m_control_queue.pop( message ) )
+        {
+            on_message( message );
+            return true;
+        }
+
+        if( !m_frame_queue.pop( message ) )
+        {
+            return false;
+        }
+
+        if( message.text.empty() )
+        {
+            // Placeholder of a coalesced gaze frame, so dispatch the latest one
+            boost::lock_guard<boost::mutex> lock( m_frame_lock );
+            swap( message, m_latest_frame );
+            m_frame_pending = false;
+        }
+
+        on_message( message );
+        return true;
+    }
+
+    bool HandleMessages::empty() const
+    {
+        return m_control_queue.empty() && m_frame_queue.empty();
+    }
+
 }
@@ -11,19 +11,25 @@
 #define _THEEYETRIBE_GAZEAPI_SOCKET_H_
 
 #include "gazeapi_observable.hpp"
+#include "gazeapi_queue.hpp"
+
+#include <gazeapi_types.h>
 
 #include <boost/asio.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/timer/timer.hpp>
 #include <boost/thread.hpp>
 
 #include <string>
 #include <vector>
-#include <deque>
+#include <set>
+#include <map>
 
 
 namespace gtl
 {
     class JSONPackageMatcher; // Forward declaration for boost::asio::is_matching_condition
+    class JSONPackageMatcherRef;
 };
 
 namespace boost
@@ -33,6 +39,10 @@ namespace boost
         template <> struct is_match_condition < gtl::JSONPackageMatcher >
             : public true_type
             {};
+
+        template <> struct is_match_condition < gtl::JSONPackageMatcherRef >
+            : public true_type
+            {};
     }
 };
 
@@ -43,94 +53,300 @@ namespace gtl
     public:
         JSONPackageMatcher();
 
+        /** Scan a contiguous block of received bytes for the end of the current message.
+         *
+         * Braces and quotes are located 16 (SSE2) or 32 (AVX2) bytes at a time, so only those
+         * positions are inspected one by one. Braces within strings are ignored. The top level "id"
+         * of the message, if any, is picked up along the way; see id().
+         *
+         * Blocks of one message must be passed in order and must directly follow each other in
+         * memory, as they do in the receive streambuf, which keeps a message until it is consumed.
+         *
+         * \param[out] complete true if the message ended within the block.
+         * \returns number of bytes consumed, including any post-amble up to the next message.
+         */
+        std::size_t scan( char const * data, std::size_t size, bool & complete );
+
         template <typename Iterator>
         std::pair<Iterator, bool> operator()( Iterator begin, Iterator end )
         {
-            Iterator i = begin;
+            // The streambuf input sequence is a single contiguous block, so scan it in place
+            std::size_t const size = end - begin;
 
-            while( i != end )
+            if( size == 0 )
             {
-                bool const left = *i == '{';
-                bool const right = *i == '}';
-                m_stack += left ? 1 : right ? -1 : 0;
-                m_in_message |= left;
-
-                ++i; // We need to make sure that '}' is consumed before returning
-
-                if( m_stack == 0 && m_in_message )
-                {
-                    while( i != end && *i != '{' )
-                    {
-                        ++i; // read all post-amble until next message starts (\r, \n, etc.)
-                    }
-
-                    m_in_message = false;
-                    return std::make_pair( i, true );
-                }
+                return std::make_pair( begin, false );
             }
-            return std::make_pair( i, false );
+
+            bool complete;
+            std::size_t const consumed = scan( &*begin, size, complete );
+            return std::make_pair( begin + consumed, complete );
+        }
+
+        /** Id of the last completed message, or -1 if it had none (e.g. pushed gaze frames). */
+        int id() const { return m_last_id; }
+
+    private:
+        bool            m_in_message;
+        bool            m_in_string;
+        bool            m_escape;
+        int             m_stack;
+        std::size_t     m_offset;       // Bytes of the current message scanned by previous calls
+        std::size_t     m_key_begin;    // Offset of a top level string being scanned, or 0
+        std::size_t     m_id_value;     // Offset just past a top level "id" key whose value is yet to be read, or 0
+        int             m_id;
+        int             m_last_id;
+    };
+
+    /** Hands a JSONPackageMatcher to async_read_until by reference, since match conditions are copied
+     *  and the state of the matcher, e.g. id(), is needed once the read completes.
+     */
+    class JSONPackageMatcherRef
+    {
+    public:
+        explicit JSONPackageMatcherRef( JSONPackageMatcher & matcher )
+            : m_matcher( &matcher )
+        {}
+
+        template <typename Iterator>
+        std::pair<Iterator, bool> operator()( Iterator begin, Iterator end )
+        {
+            return ( *m_matcher )( begin, end );
         }
 
     private:
-        bool    m_in_message;
-        size_t  m_stack;
+        JSONPackageMatcher * m_matcher;
     };
 
+    enum MessageKind
+    {
+        MK_GENERIC,         // Replies, notifications and anything not recognized below
+        MK_FRAME_PUSH       // Pushed gaze frame in the server's usual layout; 'payload' is the offset of its "frame" object
+    };
+
+    /** A received message together with the metadata found while framing it. */
+    struct ReceivedMessage
+    {
+        ReceivedMessage()
+            : id( -1 )
+            , kind( MK_GENERIC )
+            , payload( 0 )
+        {}
+
+        std::string     text;
+        int             id;
+        MessageKind     kind;
+        std::size_t     payload;
+    };
+
+    inline void swap( ReceivedMessage & a, ReceivedMessage & b )
+    {
+        a.text.swap( b.text );
+        std::swap( a.id, b.id );
+        std::swap( a.kind, b.kind );
+        std::swap( a.payload, b.payload );
+    }
+
     // Call backs from socket
     class ISocketListener
     {
     public:
         virtual ~ISocketListener() {}
-        virtual void on_message( std::string const & message ) = 0;
+        virtual void on_message( ReceivedMessage const & message ) = 0;
         virtual void on_disconnected() = 0;
+
+        // Called once a request sent with send_request() has been replied to, or has timed out
+        virtual void on_request_completed( int /*id*/, bool /*replied*/ ) {}
+
+        // Called by the dispatching thread whenever it has handled all queued messages
+        virtual void on_messages_drained() {}
+    };
+
+    enum DispatchMode
+    {
+        DM_THREAD,          // A dispatch thread of its own
+        DM_POLLED,          // No thread; dispatch_pending() is called instead
+        DM_POOL             // Drained by the threads of a shared dispatch io_service
     };
 
     class HandleMessages
     {
     public:
-        HandleMessages( class Socket & owner );
+        HandleMessages( class Socket & owner, DispatchMode mode, boost::asio::io_service * pool = 0 );
         ~HandleMessages();
     
-        void process_message( std::string const & message );
+        /** Dispatch or queue a received message.
+         *  To avoid copying, the content of 'message' may be swapped out for a recycled buffer.
+         *
+         *  Messages are queued in two lanes: pushed gaze frames in one, everything else, e.g. notifications
+         *  of tracker state and calibration changes, in a control lane that is always dispatched first. So
+         *  control messages never wait behind a backlog of frames, though they may overtake them.
+         */
+        void process_message( ReceivedMessage & message );
         void terminate();
 
+        // Terminate and wait until no message is being dispatched anymore
+        void stop();
+        void set_frame_coalescing( bool enabled );
+
+        // Applied by the dispatch thread itself, right away
+        void set_thread_options( GazeApiThreadOptions const & options );
+
+        /** Without a dispatch thread, dispatch all queued messages on the calling thread.
+         *
+         * \returns number of messages dispatched.
+         */
+        std::size_t dispatch_pending();
+
     private:
+        enum { DRAIN_BATCH = 64 }; // Messages a pool thread dispatches before letting other connections go first
+
         void run();
-        void on_message( std::string const & message );
+        void apply_thread_options();
+        void schedule();
+        void drain();
+        bool dispatch_next( ReceivedMessage & message );
+        bool empty() const;
+        void wake();
+        void on_message( ReceivedMessage const & message );
+        void on_messages_drained();
 
     private:
         Socket &                    m_owner;
-        bool                        m_terminate;
-        std::deque<std::string>     m_queue;
+        boost::atomic<bool>         m_terminate;
+        boost::atomic<bool>         m_sleeping;
+        boost::asio::io_service *   m_pool;
+        boost::atomic<bool>         m_scheduled;    // A drain task is posted to m_pool or running
+        boost::atomic<bool>         m_coalesce_frames;
+        SpscQueue<ReceivedMessage, 64>  m_control_queue;
+        SpscQueue<ReceivedMessage>  m_frame_queue;
+        boost::mutex                m_frame_lock;
+        ReceivedMessage             m_latest_frame;
+        bool                        m_frame_pending;
+        ReceivedMessage             m_polled_message;   // Also used by drain(), which never runs concurrently with itself
         boost::mutex                m_lock;
+        boost::condition_variable   m_wakeup;
+        GazeApiThreadOptions        m_thread_options;
+        boost::atomic<bool>         m_thread_options_changed;
         boost::thread               m_thread;
     };
 
     class Socket : public Observable < ISocketListener >
     {
     public:
-        Socket( int verbose_level = 0 );
+        /** \param[in] polled if true, no threads are started and messages are only handled by poll(),
+         *  run_for() and wait_request(), on the calling thread.
+         */
+        Socket( int verbose_level = 0, bool polled = false );
+
+        /** Run on a shared io_service and dispatch on the threads of 'dispatch_service', both owned by a GazeRuntime. */
+        Socket( boost::asio::io_service & io_service, boost::asio::io_service & dispatch_service, int verbose_level = 0 );
         ~Socket();
 
         bool connect( std::string const & address, std::string const & port );
         void disconnect();
+
+        /** Disconnect for good: once this returns, no listener is called anymore. */
+        void shutdown();
         bool handle_connection_state();
-        int get_id( std::string const & message ) const;
         bool send( std::string const & message );
-        bool send_sync( std::string const & message );
+
+        /** Queue 'size' bytes for sending.
+         *  While a write is in progress, messages accumulate in a reusable buffer and go out together
+         *  in a single write once it completes.
+         */
+        bool send( char const * data, std::size_t size );
+
+        /** Send a request whose reply, identified by 'id', is dispatched as soon as it is received.
+         *  Any number of requests may be in flight at once; their replies may arrive in any order.
+         *  If timeout_ms is non-zero the request is given up after that time.
+         */
+        bool send_request( int id, char const * data, std::size_t size, unsigned int timeout_ms = 0 );
+
+        /** Block until the reply to request 'id' has been dispatched.
+         *
+         * \returns false if the connection closed before the reply arrived.
+         */
+        bool wait_request( int id );
+
+        /** Set the scheduling of the socket's own I/O or dispatch thread.
+         *
+         * \returns false if there is no such thread, i.e. when polled or running on a shared io_service.
+         */
+        bool set_thread_options( GazeApiThreadRole role, GazeApiThreadOptions const & options );
+
+        /** When enabled, queued gaze frames are replaced by newer ones instead of piling up. */
+        void set_frame_coalescing( bool enabled );
+
+        bool is_polled() const { return m_polled; }
+
+        /** Polled mode: handle all pending network events and dispatch the received messages, without blocking.
+         *
+         * \returns number of messages dispatched.
+         */
+        std::size_t poll();
+
+        /** Polled mode: wait up to timeout_ms for network events, then dispatch everything received. */
+        std::size_t run_for( unsigned int timeout_ms );
+
+        boost::asio::ip::tcp::socket::native_handle_type native_handle() { return m_socket.native_handle(); }
 
     private:
-        void on_read( boost::system::error_code const & error, size_t bytes_transferred );
-        void on_write( boost::system::error_code const & error, char* data );
+        void on_read( boost::system::error_code const & error, size_t bytes_transferred, unsigned int connection );
+        void start_write();
+        void on_write( boost::system::error_code const & error, unsigned int connection );
+        void extract_message( std::size_t size, int id );
+        bool is_pending( int id );
+        void complete_request( int id, bool replied );
+        void on_request_timeout( boost::system::error_code const & error, int id );
+        void complete_all_requests();
+        void run_io( unsigned int timeout_ms );
+        void run_io_thread();
+        void apply_io_thread_options();
+        static void on_poll_timer( boost::system::error_code const & error );
+
+        // Outstanding asynchronous operations, i.e. handlers that will still run and use this socket
+        void begin_operation();
+        void end_operation();
+        void wait_operations();
+
+        class OperationScope
+        {
+        public:
+            explicit OperationScope( Socket & owner ) : m_owner( owner ) {}
+            ~OperationScope() { m_owner.end_operation(); }
+        private:
+            Socket & m_owner;
+        };
 
     private:
         friend HandleMessages;
-        boost::asio::io_service         m_io_service;
+        boost::scoped_ptr<boost::asio::io_service> m_own_io_service;    // Unless shared
+        boost::asio::io_service &       m_io_service;
+        bool                            m_shared;
+        int                             m_operations;
+        boost::mutex                    m_operations_lock;
+        boost::condition_variable       m_operations_done;
+        boost::asio::io_service::strand m_strand;       // Serializes the handlers of this socket, e.g. on several runtime I/O threads
         boost::asio::ip::tcp::socket    m_socket;
+        boost::asio::deadline_timer     m_poll_timer;
+        bool                            m_polled;
         HandleMessages                  m_handler;
         int                             m_verbose;
-        int                             m_sync_id;
+        std::set<int>                   m_pending;
+        std::set<int>                   m_abandoned;    // Requests still pending when the last connection was closed
+        std::map<int, boost::shared_ptr<boost::asio::deadline_timer> > m_timers;
+        boost::mutex                    m_sync_lock;
+        boost::condition_variable       m_sync_done;
         boost::asio::streambuf          m_buffer;
+        ReceivedMessage                 m_message;
+        boost::mutex                    m_write_lock;
+        std::vector<char>               m_outgoing;     // Messages waiting for the current write to finish
+        std::vector<char>               m_writing;      // Messages being written; swapped with m_outgoing
+        bool                            m_write_in_progress;
+        unsigned int                    m_connection;   // Counts connections, so handlers of an earlier one can be ignored
+        boost::mutex                    m_thread_options_lock;
+        GazeApiThreadOptions            m_io_thread_options;
         boost::thread                   m_thread;
         JSONPackageMatcher              m_matcher;
     };
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #ifndef NOMINMAX
+    #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #undef WIN32_LEAN_AND_MEAN
+    #undef NOMINMAX
+#else
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/resource.h>
+    #include <unistd.h>
+    #ifdef __linux__
+        #include <sys/syscall.h>
+    #endif
+#endif
+
+#include "gazeapi_thread.hpp"
+
+#include <algorithm>
+
+
+namespace gtl
+{
+    namespace
+    {
+        bool is_default( GazeApiThreadOptions const & options )
+        {
+            return options.cpu_mask == 0 && options.realtime_priority == 0 && options.nice == 0 && options.name.empty();
+        }
+    }
+
+#ifdef _WIN32
+
+    bool apply_thread_options( GazeApiThreadOptions const & options )
+    {
+        if( is_default( options ) )
+        {
+            return true; // Leave the thread as the system created it
+        }
+
+        HANDLE const thread = GetCurrentThread();
+        bool ok = true;
+
+        if( options.cpu_mask != 0 )
+        {
+            ok = SetThreadAffinityMask( thread, static_cast<DWORD_PTR>( options.cpu_mask ) ) != 0 && ok;
+        }
+
+        // Windows has no separate real-time policy for threads, so both settings map onto its priority levels
+        if( options.realtime_priority > 0 )
+        {
+            ok = SetThreadPriority( thread, THREAD_PRIORITY_TIME_CRITICAL ) != 0 && ok;
+        }
+        else if( options.nice != 0 )
+        {
+            int const priority = options.nice <= -10 ? THREAD_PRIORITY_HIGHEST :
+                options.nice < 0 ? THREAD_PRIORITY_ABOVE_NORMAL :
+                options.nice < 10 ? THREAD_PRIORITY_BELOW_NORMAL : THREAD_PRIORITY_LOWEST;
+            ok = SetThreadPriority( thread, priority ) != 0 && ok;
+        }
+        else if( options.realtime_priority < 0 )
+        {
+            ok = SetThreadPriority( thread, THREAD_PRIORITY_NORMAL ) != 0 && ok;
+        }
+
+        if( !options.name.empty() )
+        {
+            // Only available as of Windows 10, version 1607
+            typedef HRESULT ( WINAPI * SetThreadDescriptionFunction )( HANDLE, PCWSTR );
+            SetThreadDescriptionFunction const set_description = reinterpret_cast<SetThreadDescriptionFunction>(
+                GetProcAddress( GetModuleHandleW( L"kernel32.dll" ), "SetThreadDescription" ) );
+
+            std::wstring const name( options.name.begin(), options.name.end() );
+            ok = set_description != 0 && SUCCEEDED( set_description( thread, name.c_str() ) ) && ok;
+        }
+
+        return ok;
+    }
+
+#else
+
+    bool apply_thread_options( GazeApiThreadOptions const & options )
+    {
+        if( is_default( options ) )
+        {
+            return true; // Leave the thread as the system created it
+        }
+
+        pthread_t const thread = pthread_self();
+        bool ok = true;
+
+        if( options.cpu_mask != 0 )
+        {
+    #ifdef __linux__
+            cpu_set_t cores;
+            CPU_ZERO( &cores );
+            for( unsigned int core = 0; core < 64 && core < CPU_SETSIZE; ++core )
+            {
+                if( options.cpu_mask & ( 1ULL << core ) )
+                {
+                    CPU_SET( core, &cores );
+                }
+            }
+            ok = pthread_setaffinity_np( thread, sizeof( cores ), &cores ) == 0 && ok;
+    #else
+            ok = false; // e.g. macOS does not let threads be pinned to cores
+    #endif
+        }
+
+        sched_param param;
+        int policy;
+        if( options.realtime_priority > 0 )
+        {
+            param.sched_priority = std::min( options.realtime_priority, sched_get_priority_max( SCHED_FIFO ) );
+            ok = pthread_setschedparam( thread, SCHED_FIFO, &param ) == 0 && ok;
+        }
+        else if( options.realtime_priority < 0 && pthread_getschedparam( thread, &policy, &param ) == 0 && policy != SCHED_OTHER )
+        {
+            // Back to normal scheduling, e.g. after real-time scheduling was asked for earlier. Only on
+            // request, as the thread may have inherited a policy the application chose on purpose.
+            param.sched_priority = 0;
+            ok = pthread_setschedparam( thread, SCHED_OTHER, &param ) == 0 && ok;
+        }
+
+        if( options.nice != 0 )
+        {
+    #ifdef __linux__
+            // On Linux the nice value belongs to each thread, which is addressed by its thread id
+            ok = setpriority( PRIO_PROCESS, static_cast<id_t>( syscall( SYS_gettid ) ), options.nice ) == 0 && ok;
+    #else
+            ok = false; // Elsewhere it would apply to the whole process
+    #endif
+        }
+
+        if( !options.name.empty() )
+        {
+    #if defined( __linux__ )
+            ok = pthread_setname_np( thread, options.name.substr( 0, 15 ).c_str() ) == 0 && ok;
+    #elif defined( __APPLE__ )
+            ok = pthread_setname_np( options.name.c_str() ) == 0 && ok;
+    #else
+            ok = false;
+    #endif
+        }
+
+        return ok;
+    }
+
+#endif
+
+    ThreadPool::ThreadPool( unsigned int threads, GazeApiThreadOptions const & options )
+        : m_work( new boost::asio::io_service::work( m_service ) )
+    {
+        for( unsigned int i = 0; i < std::max( threads, 1u ); ++i )
+        {
+            m_threads.create_thread( boost::bind( &ThreadPool::run, &m_service, options ) );
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        m_work.reset();
+        m_threads.join_all();
+    }
+
+    /* static */ void ThreadPool::run( boost::asio::io_service * service, GazeApiThreadOptions const options )
+    {
+        apply_thread_options( options ); // Best effort; a pool has nowhere to report failures
+        service->run();
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifndef _THEEYETRIBE_GAZEAPI_THREAD_H_
+#define _THEEYETRIBE_GAZEAPI_THREAD_H_
+
+#include <gazeapi_types.h>
+
+#include <boost/asio.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+
+namespace gtl
+{
+    /** Applies 'options' to the calling thread.
+     *
+     * Threads apply their options themselves, as some settings (e.g. the nice value on Linux) can only
+     * be addressed to the calling thread portably. Default options leave the thread untouched, so it keeps
+     * e.g. a real-time policy inherited from the application.
+     *
+     * \returns false if any of the options could not be applied, e.g. for lack of privileges or
+     * because the platform does not support it. The others are applied nonetheless.
+     */
+    bool apply_thread_options( GazeApiThreadOptions const & options );
+
+    /** Fixed number of threads running an io_service, to which work is posted. */
+    class ThreadPool
+    {
+    public:
+        /** \param[in] options applied by each thread when it starts, on a best effort basis. */
+        explicit ThreadPool( unsigned int threads, GazeApiThreadOptions const & options = GazeApiThreadOptions() );
+
+        // Runs whatever is still queued before the threads exit
+        ~ThreadPool();
+
+        boost::asio::io_service & service() { return m_service; }
+
+    private:
+        ThreadPool( ThreadPool const & other );
+        ThreadPool & operator = ( ThreadPool const & other );
+
+        static void run( boost::asio::io_service * service, GazeApiThreadOptions const options );
+
+    private:
+        boost::asio::io_service                             m_service;
+        boost::scoped_ptr<boost::asio::io_service::work>    m_work;
+        boost::thread_group                                 m_threads;
+    };
+}
+
+#endif // _THEEYETRIBE_GAZEAPI_THREAD_H_
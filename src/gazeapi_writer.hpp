@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2013-present, The Eye Tribe.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in
+ * the LICENSE file in the root directory of this source tree.
+ *
+ */
+
+#ifndef _THEEYETRIBE_GAZEAPI_WRITER_H_
+#define _THEEYETRIBE_GAZEAPI_WRITER_H_
+
+#include <cstdio>  // sprintf
+#include <cstring> // memcpy, strlen
+
+
+namespace gtl
+{
+    /** Formats an outgoing request into a fixed inline buffer.
+     *
+     *  Requests are small, so they are built on the stack rather than through a stringstream, and
+     *  numbers are always written with a '.' decimal point regardless of the C locale.
+     */
+    class RequestWriter
+    {
+    public:
+        enum { CAPACITY = 512 };
+
+        RequestWriter()
+            : m_size( 0 )
+            , m_overflow( false )
+        {}
+
+        // Writes the opening of a request, i.e. everything up to but excluding "values". No id is written if 'id' is negative.
+        RequestWriter & begin( int const id, char const * category, char const * request )
+        {
+            raw( "{" );
+            if( id >= 0 )
+            {
+                raw( "\"id\":" ).integer( id ).raw( "," );
+            }
+            return raw( "\"category\":\"" ).raw( category ).raw( "\",\"request\":\"" ).raw( request ).raw( "\"" );
+        }
+
+        RequestWriter & raw( char const * text )
+        {
+            append( text, strlen( text ) );
+            return *this;
+        }
+
+        RequestWriter & integer( long long value )
+        {
+            char digits[ 24 ];
+            char * it = digits + sizeof( digits );
+            bool const negative = value < 0;
+            unsigned long long magnitude = negative ? 0ULL - static_cast<unsigned long long>( value ) : static_cast<unsigned long long>( value );
+
+            do
+            {
+                *--it = static_cast<char>( '0' + magnitude % 10 );
+                magnitude /= 10;
+            }
+            while( magnitude != 0 );
+
+            if( negative )
+            {
+                *--it = '-';
+            }
+
+            append( it, digits + sizeof( digits ) - it );
+            return *this;
+        }
+
+        RequestWriter & number( double value )
+        {
+            char digits[ 32 ];
+            int const length = sprintf( digits, "%g", value );
+
+            // Some locales use a decimal comma, which is not valid JSON
+            for( int i = 0; i < length; ++i )
+            {
+                if( digits[ i ] == ',' )
+                {
+                    digits[ i ] = '.';
+                }
+            }
+
+            append( digits, length );
+            return *this;
+        }
+
+        char const * data() const { return m_data; }
+        std::size_t size() const { return m_size; }
+
+        // False if the request did not fit into the buffer
+        bool ok() const { return !m_overflow; }
+
+    private:
+        void append( char const * text, std::size_t const length )
+        {
+            if( m_size + length > CAPACITY )
+            {
+                m_overflow = true;
+                return;
+            }
+
+            memcpy( m_data + m_size, text, length );
+            m_size += length;
+        }
+
+    private:
+        char            m_data[ CAPACITY ];
+        std::size_t     m_size;
+        bool            m_overflow;
+    };
+}
+
+#endif // _THEEYETRIBE_GAZEAPI_WRITER_H_